@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace bench {
+    struct Benchmark {
+        std::string name;
+        std::string description;
+        void (*run)(); // prints its results to the console
+    };
+
+    /// Everything listed in the developer-only Benchmarks menu
+    std::vector<Benchmark> getBenchmarks();
+
+    /// Writes a file through the download write path with and without preallocating it first
+    void preallocation();
+    /// SHA-256 and CRC32 throughput at the chunk sizes of the download, extraction and verification paths,
+    /// accelerated kernels vs the portable code
+    void hashing();
+    /// Extracts a synthetic archive shaped like an HDR release with elzip and with the parallel extractor at 1 to 3 threads
+    void extraction();
+    /// Installs the same files from a zip (deflate) and a tar.zst through their streaming extractors, the two
+    /// formats a release can be published in
+    void archiveFormats();
+    /// Extracts the synthetic archive in parallel through minizip's default stdio functions, the read-ahead backend and
+    /// the in-memory one, at 1 and 3 threads
+    void zipIo();
+}
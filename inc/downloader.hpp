@@ -0,0 +1,66 @@
+#pragma once
+#include "net.hpp"
+#include "write_behind.hpp"
+
+#include <string>
+#include <vector>
+
+namespace net {
+    /// Below this a segment isn't worth its own connection
+    static constexpr curl_off_t SEGMENT_MIN_SIZE = 16 * 1024 * 1024;
+
+    /// Sidecar next to an unfinished download, holding what a later attempt needs to resume it
+    static constexpr const char* PARTIAL_SUFFIX = ".part";
+    /// How often the sidecars of running downloads are brought up to date
+    static constexpr long SIDECAR_INTERVAL_MS = 2000;
+    /// Size and file alignment of the blocks written to the SD card
+    static constexpr size_t WRITE_BUFFER_SIZE = 256 * 1024;
+    /// Blocks that may wait for the card before receiving stalls, each running transfer holds one more while filling it
+    static constexpr size_t WRITE_QUEUE_DEPTH = 8;
+
+    /// Takes the body of a download in order on the writer thread instead of a file, return false to fail the download
+    typedef bool (*DownloadSink)(void* user_data, const char* data, size_t size);
+
+    struct Download {
+        std::string url;
+        std::vector<std::string> headers;
+        std::string path;       // file the body is written to, an unfinished one is resumed if its sidecar still matches the server
+        size_t segments = 1;    // byte ranges fetched in parallel, falls back to one stream if the server rejects ranges
+        bool preallocate = true; // size the file from Content-Length before the first write, trimmed to what arrived at the end
+        std::string expected_sha256; // lowercase hex, checked before on_complete. Such downloads aren't segmented so the bytes can be hashed in order
+        DownloadSink sink = nullptr; // replaces path when set, never segmented or resumed since the sink can't rewind
+        void* sink_data = nullptr;
+
+        // filled in by downloadAll
+        CURLcode result = CURLE_FAILED_INIT;
+        long http_code = 0;
+        curl_off_t total = 0;   // 0 until the server told us the size
+        curl_off_t now = 0;
+        bool done = false;
+        bool resumed = false;   // part of the file came from an earlier attempt
+        std::string sha256;     // of the whole file, only for downloads that weren't segmented
+        uint32_t crc32 = 0;
+        bool corrupt = false;   // the file didn't match expected_sha256 and was removed
+        bool sink_failed = false; // the sink refused the data, the transfer was stopped with CURLE_WRITE_ERROR
+    };
+
+    struct DownloadProgress {
+        curl_off_t total;   // sum of the sizes known so far
+        curl_off_t now;
+        size_t finished;
+        size_t count;
+    };
+
+    /// Called from the download loop a few times per second. Return false to cancel every transfer
+    typedef bool (*DownloadProgressCallback)(void* user_data, const DownloadProgress& progress);
+    /// Called as soon as one download is complete and its file closed, while the others keep going
+    typedef void (*DownloadCompleteCallback)(void* user_data, Download& download);
+
+    /// Downloads every file concurrently over a single curl_multi handle, at most max_concurrent files at a time
+    /// (the segments of a file don't count against it). Returns false if any download failed or the transfers
+    /// were cancelled. Interrupted files are kept with a sidecar so the next call picks up where this one stopped,
+    /// files the server refused (4xx, changed ETag, ignored ranges) or that failed verification are removed
+    bool downloadAll(std::vector<Download>& downloads, size_t max_concurrent, DownloadProgressCallback on_progress, DownloadCompleteCallback on_complete, void* user_data);
+    /// Card write statistics of the last downloadAll, stall_ms vs idle_ms tells whether the card or the network was the bottleneck
+    WriteStats getWriteStats();
+}
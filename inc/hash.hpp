@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace hash {
+    static constexpr size_t SHA256_SIZE = 32;
+    static constexpr size_t SHA256_BLOCK_SIZE = 64;
+
+    /// Incremental SHA-256 whose midstate can be saved and restored, so an interrupted download can keep hashing where it stopped.
+    /// Whole blocks go to the fastest kernel the CPU has (ARMv8 sha256h on the Switch, SHA-NI on x86)
+    class Sha256 {
+        private:
+            uint32_t m_State[8];
+            uint8_t m_Buffer[SHA256_BLOCK_SIZE];
+            uint64_t m_Length;  // bytes hashed so far, m_Length % 64 of them wait in m_Buffer
+        public:
+            Sha256() { Reset(); }
+            void Reset();
+            void Update(const void* data, size_t size);
+            /// The context has to be Reset before it can be used again
+            void Finish(uint8_t digest[SHA256_SIZE]);
+            /// Hex dump of the midstate (state words, length, buffered bytes)
+            std::string SaveState() const;
+            bool LoadState(const std::string& state);
+    };
+
+    /// CRC-32 (IEEE, the one zip uses), start with crc = 0. ARMv8 crc32x on the Switch, PCLMULQDQ folding on x86.
+    /// The SSE4.2 crc32 instruction is CRC-32C and gives different results, so it can't be used here
+    uint32_t crc32(uint32_t crc, const void* data, size_t size);
+    /// CRC of two blocks back to back from the CRCs of the blocks, second_length is the size of the second block
+    uint32_t crc32Combine(uint32_t first, uint32_t second, int64_t second_length);
+
+    /// Names of the kernels the dispatch picked, for the benchmarks
+    const char* sha256Implementation();
+    const char* crc32Implementation();
+    /// Routes everything through the portable code, so the benchmarks can compare against it
+    void forcePortable(bool portable);
+
+    std::string toHex(const uint8_t* data, size_t size);
+    /// Finds the first run of 64 hex digits in text, lowercased, empty if there is none
+    std::string findSha256(const std::string& text);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace net {
+    struct CachedResponse {
+        std::string url;
+        std::string etag;
+        std::string last_modified;
+        std::string next_page;
+        std::string body;
+    };
+
+    /// Directory the responses are stored in, caching is disabled until this is set
+    void setCacheDirectory(const std::string& directory);
+    /// The key identifies a response for a given url and set of request headers (the same url answers differently per token)
+    std::string cacheKey(const std::string& url, const std::vector<std::string>& headers);
+    bool loadCachedResponse(const std::string& key, CachedResponse& response);
+    void storeCachedResponse(const std::string& key, const CachedResponse& response);
+}
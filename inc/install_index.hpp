@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace zip {
+    /// What the installer last wrote to every path, so an update only writes the entries whose CRC or size changed.
+    /// Files are compared by size and mtime against what was recorded, only a file touched since then gets hashed
+    class InstallIndex {
+        private:
+            struct Record {
+                uint32_t crc;
+                uint64_t size;
+                int64_t mtime;  // as the card reported it right after the write
+            };
+
+            std::string m_Path;
+            std::map<std::string, Record> m_Files;
+            std::mutex m_Lock;  // the extractors check and record from several threads
+            bool m_Dirty;
+        public:
+            /// Loads the index saved at path, a missing or broken one starts empty
+            explicit InstallIndex(const std::string& path);
+            InstallIndex(const InstallIndex&) = delete;
+            InstallIndex& operator=(const InstallIndex&) = delete;
+
+            /// True if path already holds a file with this CRC and size
+            bool Unchanged(const std::string& path, uint32_t crc, uint64_t size);
+            /// Unchanged without hashing, only trusts what was recorded. Cheap enough for estimates over a whole release
+            bool Recorded(const std::string& path, uint32_t crc, uint64_t size);
+            /// Call once path holds a file with this CRC and size
+            void Record(const std::string& path, uint32_t crc, uint64_t size);
+            bool Save();
+    };
+}
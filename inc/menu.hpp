@@ -5,6 +5,7 @@
 #define MENU_MAGIC          0x1234
 #define DOWNLOADABLE_MAGIC  0xDEAD
 #define EMPTY_MAGIC         0xBEEF
+#define ACTION_MAGIC        0xCAFE
 
 struct GhDownload {
     gh::OauthToken token;
@@ -17,7 +18,8 @@ enum class NodeType {
     UNKNOWN,
     MENU,
     DOWNLOADABLE,
-    EMPTY
+    EMPTY,
+    ACTION
 };
 
 NodeType checkType(TreeNode* node);
@@ -25,7 +27,12 @@ NodeType checkType(TreeNode* node);
 void makeMenu(TreeNode* node, const std::string& title, const std::vector<std::string>& entries);
 void makeDownloadable(TreeNode* node, const std::string& title, const std::string& body, const GhDownload& download);
 void makeEmpty(TreeNode* node, const std::string& title, const std::string& message);
+/// Runs the action when focused, then waits for B like a download does
+void makeAction(TreeNode* node, const std::string& title, const std::string& description, void (*action)());
 
+/// Replaces the entries of an existing menu, keeping the selection where possible
+void menuSetEntries(TreeNode* node, const std::vector<std::string>& entries);
+void menuAddEntry(TreeNode* node, const std::string& entry);
 void menuSelect(TreeNode* node, size_t selected);
 size_t menuGetSelected(TreeNode* node);
 size_t menuGetEntryCount(TreeNode* node);
\ No newline at end of file
@@ -0,0 +1,131 @@
+#pragma once
+#include <curl/curl.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace net {
+    /// A request that stays below STALL_SPEED bytes a second for STALL_SECONDS is given up on. CURLOPT_CONNECTTIMEOUT only
+    /// covers connecting, a connection that goes quiet afterwards would otherwise hold its caller (and shutdown) forever
+    static constexpr long STALL_SPEED = 1024;
+    static constexpr long STALL_SECONDS = 30;
+
+    struct PoolStats {
+        size_t requests;            // transfers performed through the pool
+        size_t connections_opened;  // transfers that had to connect (DNS + TCP + TLS)
+        size_t handshakes_avoided;  // transfers that went over an already established connection
+        size_t api_wire_bytes;      // API response bodies as they came over the wire (compressed)
+        size_t api_decoded_bytes;   // the same bodies after content decoding
+    };
+
+    /// Sets up the session-wide share (DNS, TLS sessions and connections). Call after curl_global_init
+    void init();
+    /// Frees every pooled handle and the share. Call before curl_global_cleanup
+    void cleanup();
+
+    /// Response body storage. Reserves the advertised Content-Length up front, appends exactly the bytes curl hands over
+    /// and keeps its capacity when cleared, so a handle that has been used once appends chunks without allocating
+    class ResponseBuffer {
+        private:
+            std::string m_Data;
+        public:
+            static constexpr size_t MAX_RESERVE = 16 * 1024 * 1024; // Content-Length is only a hint, never trust it blindly
+
+            void Clear() { m_Data.clear(); }
+            void Reserve(size_t size) {
+                if (size > m_Data.capacity() && size <= MAX_RESERVE)
+                    m_Data.reserve(size);
+            }
+            void Append(const char* data, size_t size) { m_Data.append(data, size); }
+            const char* Data() const { return m_Data.data(); }
+            size_t Size() const { return m_Data.size(); }
+
+            /// CURLOPT_WRITEFUNCTION, the chunk is not NUL terminated
+            static size_t WriteCallback(char* to_write, size_t size, size_t byte_count, void* user_data) {
+                ((ResponseBuffer*)user_data)->Append(to_write, size * byte_count);
+                return size * byte_count;
+            }
+    };
+
+    struct PooledHandle {
+        CURL* handle;
+        ResponseBuffer buffer; // lives as long as the handle, reused by every request made with it
+    };
+
+    /// Hands out an easy handle that is attached to the session share. Never returns a handle that is in use
+    PooledHandle* acquireHandle();
+    /// Resets the handle and puts it back into the pool, live connections stay in the share
+    void releaseHandle(PooledHandle* pooled);
+    /// Records the connection statistics of the last transfer performed on the handle
+    void recordTransfer(CURL* handle, CURLcode result);
+    PoolStats getStats();
+
+    struct Request {
+        std::string url;
+        std::vector<std::string> headers;
+        bool cached = false; // revalidate with If-None-Match/If-Modified-Since against the on-disk cache
+        std::string post_body; // sent as a POST when not empty, POST responses are never cached
+        bool follow_redirects = false; // release asset urls redirect to the CDN
+        std::string range; // "first-last" or "-suffix_length" sent as a Range header, a server that answers with the whole body is cut off after its headers
+
+        // filled in by perform/performBatch
+        CURLcode result = CURLE_FAILED_INIT;
+        long http_code = 0;
+        std::string body;
+        std::string etag;
+        std::string last_modified;
+        std::string next_page; // rel="next" url of the Link header, empty on the last page
+        std::string content_range; // "bytes first-last/total" of a 206
+        std::string content_type; // multipart/byteranges when a multi-range request was answered with several parts
+        bool from_cache = false; // the server answered 304 and the body was read from disk
+    };
+
+    /// "bytes first-last/total" as found in a Content-Range, the total has to be known
+    bool parseContentRange(const std::string& value, uint64_t& first, uint64_t& last, uint64_t& total);
+
+    /// Performs a single request through the pool
+    void perform(Request& request);
+    /// Runs every request at the same time over a single curl_multi handle and returns once all of them are done,
+    /// so the whole batch takes as long as its slowest request
+    void performBatch(std::vector<Request>& requests);
+
+    struct CURL_builder {
+        PooledHandle* pooled;
+        CURL* request;
+        curl_slist* headers;
+
+        CURL_builder() : pooled(nullptr), request(nullptr), headers(nullptr) {
+            pooled = acquireHandle();
+            if (pooled != nullptr)
+                request = pooled->handle;
+        }
+        ~CURL_builder() {
+            if (pooled != nullptr)
+                releaseHandle(pooled);
+            if (headers != nullptr)
+                curl_slist_free_all(headers);
+        }
+        CURL_builder(const CURL_builder&) = delete;
+        CURL_builder& operator=(const CURL_builder&) = delete;
+
+        operator bool() { return request != nullptr; } // for convenience
+        template <typename T>
+        CURL_builder& SetOPT(CURLoption opt, T param) { curl_easy_setopt(request, opt, param); return *this; } // generic to mimic the #define macro CURL uses
+        CURL_builder& SetHeaders(std::vector<std::string> _headers) {
+            if (headers != nullptr)
+                curl_slist_free_all(headers);
+            headers = nullptr;
+            for (std::string x : _headers)
+                headers = curl_slist_append(headers, x.c_str());
+            SetOPT(CURLOPT_HTTPHEADER, headers);
+            return *this;
+        }
+        CURL_builder& SetURL(const std::string& url) { SetOPT(CURLOPT_URL, url.c_str()); return *this; }
+        CURLcode Perform() {
+            CURLcode result = curl_easy_perform(request);
+            recordTransfer(request, result);
+            return result;
+        }
+    };
+}
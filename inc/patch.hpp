@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "install_index.hpp"
+#include "zip_io.hpp"
+
+namespace patch {
+    /// A release may carry "patch-from-<tag>.zip" assets that rebuild its zips from an installed <tag>. Every entry is
+    /// either "<path>.zst", made with `zstd --patch-from=<path of tag> <path>`, or a file that is copied as is
+    static constexpr const char* ASSET_PREFIX = "patch-from-";
+    static constexpr const char* ASSET_EXTENSION = ".zip";
+    static constexpr const char* DELTA_EXTENSION = ".zst";
+    /// The installed file a delta is made against is read into memory whole, and the decoder keeps a window about as
+    /// large next to it. A larger file fails its delta, which puts the full zips back on the install list
+    static constexpr uint64_t MAX_REFERENCE_SIZE = 32 * 1024 * 1024;
+    /// --patch-from sizes the window to the files, this is the largest one accepted (64 MiB, twice MAX_REFERENCE_SIZE)
+    static constexpr int WINDOW_LOG_MAX = 26;
+
+    struct PatchStats {
+        size_t patched;     // rebuilt from the installed file
+        size_t added;       // copied from the patch
+        uint64_t bytes;     // written
+    };
+
+    /// Name of the asset that patches an install of tag
+    std::string assetName(const std::string& tag);
+    bool isPatchAsset(const std::string& filename);
+
+    /// Rebuilds the files of a patch archive under root. Deltas must carry a content checksum, which is what catches
+    /// an installed file that isn't the one the patch was made from. All or nothing: the new files go to pending names
+    /// and only replace the installed ones once every entry applied. io replaces minizip's stdio functions, see zip_io.hpp
+    bool applyPatch(const std::string& archive, const std::string& root, zip::InstallIndex* index = nullptr, PatchStats* stats = nullptr, std::string* error = nullptr,
+                    const zlib_filefunc64_def* io = nullptr);
+}
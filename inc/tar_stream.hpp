@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "install_index.hpp"
+#include "write_behind.hpp"
+
+struct ZSTD_DCtx_s;
+
+namespace tar {
+    static constexpr size_t BLOCK_SIZE = 512;
+    static constexpr const char* ASSET_EXTENSION = ".tar.zst";
+    /// --long archives need more than the default 128 MiB window, this is the largest one accepted (256 MiB)
+    static constexpr int WINDOW_LOG_MAX = 28;
+
+    /// True for assets this extractor handles, by name since GitHub serves them as application/octet-stream
+    bool isTarZst(const std::string& filename);
+
+    /// Extracts a .tar.zst while it is still arriving, zstd decodes and the tar is parsed on the thread that feeds it,
+    /// the files are written by a write-behind thread of its own. Like zip::StreamExtractor the files go to pending
+    /// names until Commit. Tar has no per-file checksum, integrity comes from the zstd content checksum (and the
+    /// download's SHA-256), so the index can't tell an unchanged file in advance and every file is written
+    class StreamExtractor {
+        private:
+            enum class State {
+                HEADER,     // collecting a 512 byte header into m_Block
+                DATA,       // file contents, m_Remaining left
+                PADDING,    // up to the next block boundary
+                METADATA,   // GNU long name or pax record, collected into m_Metadata
+                END,        // two zero blocks seen
+                FAILED
+            };
+
+            std::string m_Root;
+            zip::InstallIndex* m_Index;
+            State m_State;
+            std::unique_ptr<ZSTD_DCtx_s, size_t (*)(ZSTD_DCtx_s*)> m_Decoder;
+            std::unique_ptr<char[]> m_Decoded;
+            size_t m_DecodedSize;
+            size_t m_FrameLeft;         // what ZSTD_decompressStream still expects, 0 between frames
+            std::string m_Block;
+            size_t m_ZeroBlocks;
+            uint64_t m_Remaining;
+            size_t m_Padding;
+            char m_MetadataType;
+            std::string m_Metadata;
+            std::string m_LongName;     // from the GNU 'L' or pax entry before the header it applies to
+
+            // file being extracted
+            FILE* m_File;
+            uint32_t m_Crc;
+            uint64_t m_Size;
+            char* m_Buffer;
+            size_t m_Filled;
+            int64_t m_Position;
+
+            bool m_WriteFailed;         // set by the writer thread, only read after a Sync
+            net::WriteBehind m_Writer;
+            struct Extracted {
+                std::string pending;    // cleared once moved
+                std::string path;
+                uint32_t crc;
+                uint64_t size;
+            };
+            std::vector<Extracted> m_Extracted;
+            std::set<std::string> m_Names;
+            std::string m_Error;
+
+            bool Fail(const std::string& error);
+            bool FeedTar(const char* data, size_t size);
+            bool ParseHeader();
+            bool BeginFile(const std::string& name);
+            bool WriteData(const char* data, size_t size);
+            void SubmitBuffer();
+            void CloseFile();
+            bool EndFile();
+            void ApplyPax();
+        public:
+            explicit StreamExtractor(const std::string& root, zip::InstallIndex* index = nullptr);
+            ~StreamExtractor(); // removes whatever wasn't committed
+            StreamExtractor(const StreamExtractor&) = delete;
+            StreamExtractor& operator=(const StreamExtractor&) = delete;
+
+            /// Compressed bytes in, returns false once the archive turned out to be broken
+            bool Feed(const char* data, size_t size);
+            /// True if the zstd frame and the tar both ended properly and every file made it to the card
+            bool Finish();
+            /// Moves the extracted files over their destinations and records them in the index
+            bool Commit();
+            void Abort();
+
+            const std::string& Error() const { return m_Error; }
+            size_t Written() const { return m_Extracted.size(); }
+    };
+
+    /// Same extraction for a .tar.zst that is already on the card
+    bool extractArchive(const std::string& archive, const std::string& root, zip::InstallIndex* index = nullptr, size_t* written = nullptr, std::string* error = nullptr);
+}
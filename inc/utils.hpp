@@ -7,6 +7,10 @@
 #include <iostream>
 #include <cstring>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <deque>
+#include <condition_variable>
 #include <cmath>
 #include <thread>
 #include <chrono>
@@ -19,6 +23,16 @@
 #include <elzip/elzip.hpp>
 
 #include "console.h"
+#include "net.hpp"
+#include "http_cache.hpp"
+#include "downloader.hpp"
+#include "hash.hpp"
+#include "zip_stream.hpp"
+#include "zip_extract.hpp"
+#include "patch.hpp"
+#include "tar_stream.hpp"
+#include "zip_ranges.hpp"
+#include "zip_remote.hpp"
 
 using json = nlohmann::json;
 
@@ -37,7 +51,15 @@ static constexpr char* BETA_REPO      = "blu-dev/HDR-Beta-Builds";
 static constexpr char* DEV_REPO       = "blu-dev/HDR-Dev-Builds";
 static constexpr char* APP_REPO       = "FaultyPine/HDR-Installer-Homebrew";
 
+static constexpr int   RELEASES_PER_PAGE = 100; // the maximum the API allows
+static constexpr int   ASSETS_PER_RELEASE = 100; // GraphQL's page limit, a release with more has its assets listed through REST
+static constexpr size_t MEMORY_ASSET_SIZE = 32 * 1024 * 1024; // zips up to this size that aren't streamed are downloaded to RAM, not the card
+
 static constexpr char* OAUTH_FILE   = "oauth.txt";
+static constexpr char* SNAPSHOT_FILE = "snapshot.json";
+static constexpr char* SETTINGS_FILE = "settings.json";
+static constexpr char* INSTALL_INDEX_FILE = "install_index.json";
+static constexpr char* INSTALLED_RELEASE_FILE = "installed_release.json";
 
 namespace gh {
     struct Release {
@@ -45,10 +67,25 @@ namespace gh {
         std::string tag;
         std::string body;
     };
+    struct Channel {
+        std::string repository;
+        bool has_access;
+        bool fetched; // false when the network gave no definite answer, the data should not replace older data
+        std::vector<Release> releases;
+        std::string next_page; // url of the releases that didn't fit in the first page, empty if there are none
+    };
+    struct ReleasePage {
+        bool fetched; // false when the request failed, next_page is then meaningless
+        bool retryable; // the failure may go away on its own: no answer, a 5xx or a rate limit
+        std::vector<Release> releases;
+        std::string next_page; // url of the following page, empty on the last one
+    };
     struct AssetInfo {
         std::filesystem::path url;
         std::string content_type;
         std::string filename;
+        size_t size = 0; // bytes, 0 when the API didn't say
+        std::string sha256; // published digest (lowercase hex), empty when the release doesn't publish one
     };
 
     enum class DownloadResult {
@@ -56,7 +93,30 @@ namespace gh {
         CURL_ERROR,
         DOES_NOT_EXIST,
         DOWNLOAD_FAILED,
-        ACCESS_DENIED
+        ACCESS_DENIED,
+        VERIFICATION_FAILED,
+        EXTRACTION_FAILED,
+        NOT_ENOUGH_SPACE
+    };
+    struct InstallStats {
+        size_t written;     // files extracted (or assets moved into place)
+        size_t skipped;     // already installed with the same CRC and size
+        std::string patched_from; // tag a patch asset was applied on top of, empty when the full zips were downloaded
+        uint64_t ranged_bytes;          // fetched with Range requests to update zips that weren't downloaded whole
+        uint64_t ranged_archive_bytes;  // size of those zips
+        std::string error;  // what the extractor said about the first asset it failed on
+    };
+    struct InstallEstimate {
+        size_t files;               // in the zips plus the assets installed as they are
+        uint64_t download_bytes;
+        uint64_t install_bytes;     // everything the release puts on the card
+        uint64_t write_bytes;       // what the install needs on the card, files the install index has are left out
+        uint64_t free_bytes;        // on the SD card
+        bool complete;              // false if an archive couldn't be inspected, its contents aren't counted
+    };
+    enum class Backend {
+        REST,       // one request per permission check, release page and asset list
+        GRAPHQL     // a single api.github.com/graphql request for every channel, needs a token
     };
     typedef const char* OauthToken;
     // using paths for urls gives access to really helpful member funcs
@@ -68,12 +128,56 @@ namespace gh {
     bool isBetaTester(OauthToken token);
     bool isDeveloper(OauthToken token);
 
+    /// Drops the cached permission check of a repository, the next check goes to the network again
+    void invalidatePermissions(OauthToken token, const std::string& repository);
+    /// Drops every cached permission check
+    void invalidatePermissions();
+
+    /// Lists every release of the repository, following the pagination
     std::vector<Release> getReleases(OauthToken token, const std::string& repository);
+    /// Fetches a single page of a release list, for menus that load older releases on demand
+    ReleasePage getReleasePage(OauthToken token, const std::string& url);
+    /// Checks access to every repository and lists the releases of the ones the user can see, all requests run concurrently
+    std::vector<Channel> getChannels(OauthToken token, const std::vector<std::string>& repositories);
+    /// Backend used by getChannels, GraphQL falls back to REST when it fails or there is no token
+    void setBackend(Backend selected);
+    /// Base url of the API, "https://api.github.com" unless pointed at a stand-in server
+    void setApiRoot(const std::string& root);
+    /// Last channel list saved for this token, lets the menu come up before the network answers
+    bool loadChannelSnapshot(OauthToken token, std::vector<Channel>& channels);
+    void saveChannelSnapshot(OauthToken token, const std::vector<Channel>& channels);
     DownloadResult downloadRelease(OauthToken token, const std::string& repository, const std::string& tag, const std::string& filepath_root = SYSTEM_ROOT);
+    /// Files written vs skipped by the last downloadRelease
+    InstallStats getInstallStats();
+    /// Lists the entries of a zip asset from its central directory, fetched with Range requests instead of the whole zip
+    bool getAssetEntries(OauthToken token, const AssetInfo& asset, zip::RemoteArchive& archive, std::string* error = nullptr);
+    /// Sizes an install of a release from the central directories of its zips, without downloading them
+    InstallEstimate estimateInstall(OauthToken token, const std::string& repository, const std::string& tag);
+    /// Estimate the last downloadRelease checked the free space against
+    InstallEstimate getInstallEstimate();
 }
+/// Tunables read from SETTINGS_FILE, every key is optional
+struct Settings {
+    size_t max_parallel_downloads;  // release assets downloaded at the same time
+    size_t download_segments;       // connections a single large asset is split across
+    bool preallocate_downloads;     // size downloads up front, see the preallocation benchmark
+    bool stream_extraction;         // inflate zips while they download instead of saving them to the card first
+    size_t extract_threads;         // workers extracting a zip that is already on the card, see the extraction benchmark. At most
+                                    // zip::APPLICATION_CORES, every worker holds its own open archive
+    bool incremental_install;       // only write the files whose CRC or size differ from what INSTALL_INDEX_FILE says is installed
+    bool patch_updates;             // apply a zstd patch against the installed release instead of downloading the full zips
+    bool range_updates;             // fetch only the zip entries that differ from the installed files, needs incremental_install.
+                                    // Those entries are only checked against the zip's own CRC-32s, which catch a bad transfer
+                                    // but not a tampered zip, so assets with a published SHA-256 are still downloaded whole
+    std::string api_root;           // replaces https://api.github.com when set, only read by `make API_FIXTURE=1` builds since
+                                    // the token goes along. scripts/api_fixture.py serves canned answers offline
+};
+extern Settings settings;
+
 void pauseForText(int seconds = 3);
 gh::OauthToken loadOauthToken();
 void destroyOauthToken(gh::OauthToken token);
+void loadSettings();
 void prep();
 /*
 extern json installed_json;
@@ -0,0 +1,77 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace net {
+    /// Sizes the file up front so FAT/exFAT allocates its clusters in one go instead of one write at a time
+    bool preallocate(FILE* file, int64_t size);
+
+    /// Called by the writer thread after a buffer made it to the card, in the order the buffers were submitted.
+    /// Returning false marks the job as failed, same as a failed write
+    typedef bool (*WrittenCallback)(void* user_data, const char* data, size_t size);
+
+    struct WriteStats {
+        uint64_t bytes;             // written to the card
+        uint64_t writes;            // one per buffer
+        size_t max_queue_depth;     // buffers waiting for the card at the worst moment
+        size_t queue_capacity;
+        uint64_t stall_ms;          // receiving was blocked because every buffer was waiting for the card
+        uint64_t idle_ms;           // the writer had nothing to do because data wasn't coming in fast enough
+        uint64_t write_ms;          // spent inside fwrite
+    };
+
+    /// Moves SD card writes off the network thread. Buffers are filled by the producer and handed to a writer thread,
+    /// the producer only blocks when queue_capacity buffers are already waiting for the card
+    class WriteBehind {
+        private:
+            struct Job {
+                FILE* file;
+                int64_t offset;
+                char* buffer;
+                size_t size;
+                bool* failed;
+                WrittenCallback on_written;
+                void* user_data;
+            };
+
+            size_t m_BufferSize;
+            size_t m_QueueCapacity;
+            std::vector<std::unique_ptr<char[]>> m_Buffers;
+            std::vector<char*> m_Free;
+            std::deque<Job> m_Queue;
+            bool m_Busy;                // the writer is in the middle of a job
+            bool m_Closing;
+            WriteStats m_Stats;
+            std::mutex m_Lock;
+            std::condition_variable m_Work;     // a job was queued or the writer should exit
+            std::condition_variable m_Space;    // a job was finished
+            std::thread m_Thread;
+
+            void Run();
+        public:
+            WriteBehind(size_t queue_capacity, size_t buffer_size);
+            ~WriteBehind(); // writes whatever is still queued
+            WriteBehind(const WriteBehind&) = delete;
+            WriteBehind& operator=(const WriteBehind&) = delete;
+
+            size_t BufferSize() const { return m_BufferSize; }
+            /// An empty buffer of BufferSize() bytes, blocks while the queue is full
+            char* Acquire();
+            /// Queues size bytes of buffer for writing at offset, the buffer goes back to the pool afterwards.
+            /// *failed is set by the writer thread if the write fails, it must stay valid until Sync() returns.
+            /// on_written sees the bytes after they were written, that's where hashes are fed without reading the file again.
+            /// Without a file nothing is written and on_written is the only consumer of the buffer
+            void Submit(FILE* file, int64_t offset, char* buffer, size_t size, bool* failed, WrittenCallback on_written = nullptr, void* user_data = nullptr);
+            /// Gives back a buffer that won't be submitted
+            void Release(char* buffer);
+            /// Blocks until everything submitted so far is written
+            void Sync();
+            WriteStats Stats();
+    };
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "install_index.hpp"
+#include "zip_io.hpp"
+
+namespace zip {
+    /// Cores an application may run on, the fourth one belongs to the system
+    static constexpr size_t APPLICATION_CORES = 3;
+
+    struct ExtractStats {
+        size_t threads;
+        size_t entries;         // files written
+        size_t skipped;         // files the index said were already installed
+        uint64_t bytes;         // uncompressed
+        uint64_t list_ms;       // reading the central directory and creating the folders
+        uint64_t extract_ms;
+    };
+
+    /// Extracts a zip from the card on several threads. The central directory is read once, then every worker opens its
+    /// own unzFile so they never fight over a file position, and takes the next entry from a list that starts with the
+    /// large ones, largest first, so a big file can't be the one left running at the end. Returns false on the first entry
+    /// that fails, error says which. With an index, files it says are already there are skipped and written ones recorded.
+    /// io replaces minizip's stdio functions, see zip_io.hpp, every worker opens the archive through them
+    bool extractParallel(const std::string& archive, const std::string& root, size_t threads, ExtractStats* stats = nullptr, std::string* error = nullptr,
+                         InstallIndex* index = nullptr, const zlib_filefunc64_def* io = nullptr);
+}
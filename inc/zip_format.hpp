@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace zip {
+    /// Record layouts shared by the streaming extractor and the remote central directory reader
+    namespace format {
+        static constexpr uint32_t LOCAL_SIGNATURE       = 0x04034b50;
+        static constexpr uint32_t DESCRIPTOR_SIGNATURE  = 0x08074b50;
+        static constexpr uint32_t CENTRAL_SIGNATURE     = 0x02014b50;
+        static constexpr uint32_t ZIP64_END_SIGNATURE   = 0x06064b50;
+        static constexpr uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+        static constexpr uint32_t END_SIGNATURE         = 0x06054b50;
+
+        static constexpr size_t SIGNATURE_SIZE      = 4;
+        static constexpr size_t LOCAL_HEADER_SIZE   = 30;
+        static constexpr size_t CENTRAL_HEADER_SIZE = 46;
+        static constexpr size_t ZIP64_END_SIZE      = 56;
+        static constexpr size_t ZIP64_LOCATOR_SIZE  = 20;
+        static constexpr size_t END_SIZE            = 22;
+
+        static constexpr uint16_t FLAG_ENCRYPTED    = 1 << 0;
+        static constexpr uint16_t FLAG_DESCRIPTOR   = 1 << 3;  // crc and sizes follow the data instead of being in the local header
+        static constexpr uint16_t METHOD_STORED     = 0;
+        static constexpr uint16_t METHOD_DEFLATED   = 8;
+        static constexpr uint16_t ZIP64_EXTRA_ID    = 0x0001;
+        static constexpr uint32_t ZIP64_MARKER      = 0xFFFFFFFF;
+
+        inline uint16_t read16(const std::string& data, size_t at) {
+            return (uint8_t)data[at] | (uint8_t)data[at + 1] << 8;
+        }
+
+        inline uint32_t read32(const std::string& data, size_t at) {
+            return read16(data, at) | (uint32_t)read16(data, at + 2) << 16;
+        }
+
+        inline uint64_t read64(const std::string& data, size_t at) {
+            return read32(data, at) | (uint64_t)read32(data, at + 4) << 32;
+        }
+
+        /// Finds an extra field block by id, field is set to its data
+        inline bool findExtra(const std::string& extra, uint16_t id, std::string& field) {
+            size_t at = 0;
+            while (at + 4 <= extra.size()) {
+                uint16_t length = read16(extra, at + 2);
+                if (at + 4 + length > extra.size())
+                    break;
+                if (read16(extra, at) == id) {
+                    field = extra.substr(at + 4, length);
+                    return true;
+                }
+                at += 4 + length;
+            }
+            return false;
+        }
+
+        /// Zip64 extra fields only hold the values whose 32 bit field is maxed out, in this order
+        inline void applyZip64(const std::string& extra, uint64_t* values[], size_t count) {
+            std::string field;
+            if (!findExtra(extra, ZIP64_EXTRA_ID, field))
+                return;
+            size_t at = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (*values[i] != ZIP64_MARKER)
+                    continue;
+                if (at + 8 > field.size())
+                    return;
+                *values[i] = read64(field, at);
+                at += 8;
+            }
+        }
+    }
+}
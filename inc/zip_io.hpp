@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include <minizip/ioapi.h>
+
+namespace zip {
+    /// Most the buffered backend reads from the card at once. minizip asks for a few dozen bytes at a time while it walks
+    /// the headers and seeks before every read, stdio's own buffer is tiny and thrown away on every one of those seeks
+    static constexpr size_t READ_AHEAD_SIZE = 1024 * 1024;
+    /// Read-ahead after a jump, it doubles with every refill that continues where the last one ended. The extractor takes
+    /// entries by size rather than position, a full READ_AHEAD_SIZE for every small file would mostly be thrown away
+    static constexpr size_t READ_AHEAD_MIN = 64 * 1024;
+
+    /// An archive already in memory, the path given to unzOpen2_64 is ignored. Must outlive every unzFile opened on it
+    struct MemoryArchive {
+        const char* data;
+        size_t size;
+    };
+
+    /// Read only stdio with a read-ahead buffer per open file. Seeks that land inside the buffer don't reach the card,
+    /// reads larger than the current read-ahead go straight into the caller's memory
+    void fillBufferedFileFunctions(zlib_filefunc64_def* functions);
+    /// Read only, every open gets its own position so several unzFiles can share one archive
+    void fillMemoryFileFunctions(zlib_filefunc64_def* functions, const MemoryArchive* archive);
+}
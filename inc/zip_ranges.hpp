@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "install_index.hpp"
+#include "zip_remote.hpp"
+
+namespace zip {
+    /// Gaps between changed entries up to this size are downloaded along with them instead of starting another range
+    static constexpr uint64_t RANGE_MERGE_GAP = 64 * 1024;
+    /// Ranges asked for in one request, keeps the Range header far from the limits servers put on it
+    static constexpr size_t RANGES_PER_REQUEST = 32;
+    /// Bytes asked for in one request, the answer stays in memory until its entries are written. An entry larger
+    /// than this still comes in one piece
+    static constexpr uint64_t RANGE_REQUEST_BYTES = 8 * 1024 * 1024;
+    /// Changed entries taking more than this share of the archive (in percent) are fetched by downloading it whole
+    static constexpr uint64_t RANGE_FETCH_MAX_SHARE = 50;
+
+    struct ByteRange {
+        uint64_t first;
+        uint64_t last;                  // inclusive, like the Range header
+        std::vector<size_t> entries;    // indices into RemoteArchive::entries, all of them lie inside the range
+    };
+
+    enum class RangeResult {
+        INSTALLED,      // the changed entries are in place, possibly none
+        NOT_WORTH_IT,   // too much changed, download the archive instead
+        UNSUPPORTED,    // the server ignores ranges, download the archive instead
+        FAILED          // nothing was installed, error says why
+    };
+
+    struct RangeStats {
+        size_t changed;     // entries fetched and written
+        size_t unchanged;   // entries the index said were already installed
+        uint64_t bytes;     // fetched, headers and merged gaps included
+        size_t requests;
+        bool multipart;     // the server answered multi-range requests with several parts, otherwise it got one range at a time
+    };
+
+    /// Byte ranges that cover the local headers and data of the given entries, in archive order. An entry ends where the
+    /// next one starts, so neighbours (and entries with small gaps between them) merge into a single range
+    std::vector<ByteRange> planRanges(const RemoteArchive& archive, const std::vector<size_t>& entries);
+
+    /// Installs the entries of a remote zip whose CRC or size differ from what the index says is on the card, fetching
+    /// only their bytes with multi-range requests, parallel requests at a time. Servers that answer a multi-range
+    /// request with a single part get one range per request from then on. All or nothing like the streaming extractor:
+    /// the files go to pending names and only replace the installed ones once every entry checked out
+    RangeResult fetchChangedEntries(const std::string& url, const std::vector<std::string>& headers, const RemoteArchive& archive, const std::string& root,
+                                    InstallIndex& index, size_t parallel, RangeStats* stats = nullptr, std::string* error = nullptr);
+}
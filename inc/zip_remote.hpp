@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "zip_stream.hpp"
+
+namespace zip {
+    /// Fetched from the end of the archive first, enough for the end records with the longest comment a zip can have,
+    /// and the central directory of a typical release comes along with them
+    static constexpr size_t REMOTE_TAIL_SIZE = 256 * 1024;
+    /// Central directories larger than this aren't fetched, a release has a few thousand entries of ~100 bytes each
+    static constexpr uint64_t MAX_CENTRAL_DIRECTORY_SIZE = 32 * 1024 * 1024;
+
+    struct RemoteArchive {
+        uint64_t size;                  // of the whole archive
+        uint64_t central_offset;        // where the central directory starts, the data of the last entry ends there
+        uint64_t compressed_bytes;
+        uint64_t uncompressed_bytes;
+        std::vector<EntryInfo> entries; // in central directory order, folders included
+    };
+
+    /// Reads the central directory of a zip on a server that honours Range requests without downloading its entries.
+    /// One suffix range brings the end records, a second one the rest of the directory when it didn't fit in the first
+    bool readRemoteDirectory(const std::string& url, const std::vector<std::string>& headers, RemoteArchive& archive, std::string* error = nullptr);
+    /// Same for several archives, their tails are fetched at the same time over one multi handle. archives[i] is left
+    /// nullptr for the ones that couldn't be read
+    void readRemoteDirectories(const std::vector<std::string>& urls, const std::vector<std::string>& headers, std::vector<std::unique_ptr<RemoteArchive>>& archives);
+}
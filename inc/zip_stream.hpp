@@ -0,0 +1,105 @@
+#pragma once
+#include <zlib.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "install_index.hpp"
+
+namespace zip {
+    /// Extracted files carry this suffix until Commit moves them into place
+    static constexpr const char* PENDING_SUFFIX = ".hdrnew";
+    /// Inflate output is written in chunks of this size
+    static constexpr size_t OUTPUT_CHUNK_SIZE = 64 * 1024;
+
+    /// Keeps entries inside the root, no absolute paths, drive letters or ".." components
+    bool safeEntryName(const std::string& name);
+
+    struct EntryInfo {
+        std::string name;
+        uint32_t crc;
+        uint64_t compressed_size;
+        uint64_t size;
+        uint64_t offset;    // of the local header in the archive
+    };
+
+    /// Extracts a zip while it is still arriving, without the archive ever touching the disk. Local headers are parsed
+    /// as bytes come in, stored and deflated entries (with or without data descriptors) are written next to their
+    /// destination, and the central directory at the end has to agree with everything that was extracted.
+    /// Entries an index says are already installed are passed over without inflating them, as long as the local header
+    /// has their CRC (data descriptor entries don't, they are always written)
+    class StreamExtractor {
+        private:
+            enum class State {
+                RECORD,     // collecting a header record into m_Record
+                DATA,       // entry data, not buffered
+                END,        // end of central directory seen, anything after it is the comment
+                FAILED
+            };
+
+            std::string m_Root;
+            InstallIndex* m_Index;
+            State m_State;
+            std::string m_Record;
+            size_t m_Needed;            // m_Record is parsed once it holds this many bytes
+            uint64_t m_Offset;          // archive offset of the next byte fed
+            uint64_t m_RecordStart;
+
+            // entry being extracted
+            EntryInfo m_Entry;
+            uint16_t m_Flags;
+            uint16_t m_Method;
+            bool m_Zip64;
+            bool m_SizeKnown;           // the local header has the compressed size, no need to find the end of the deflate stream
+            bool m_Skipping;            // already installed, the data is only counted
+            uint64_t m_Consumed;        // compressed bytes of the entry so far
+            uint32_t m_Crc;
+            uint64_t m_Written;
+            FILE* m_File;
+            z_stream m_Inflate;
+            bool m_InflateReady;
+            std::unique_ptr<char[]> m_Output;
+
+            std::vector<EntryInfo> m_Entries;
+            std::map<std::string, size_t> m_EntryIndex;
+            std::vector<std::pair<std::string, size_t>> m_Extracted; // (pending path, index in m_Entries), pending is cleared once moved
+            size_t m_Skipped;
+            size_t m_CentralCount;
+            bool m_Descriptor;          // the record being collected is the data descriptor of m_Entry
+            std::string m_Error;
+
+            bool Fail(const std::string& error);
+            bool ParseRecord();
+            bool BeginEntry();
+            size_t FeedData(const char* data, size_t size);
+            bool WriteOutput(const char* data, size_t size);
+            bool EndEntryData();
+            bool CloseEntry(uint32_t crc, uint64_t compressed_size, uint64_t size);
+            bool ParseDescriptor();
+            bool CheckCentralEntry();
+        public:
+            explicit StreamExtractor(const std::string& root, InstallIndex* index = nullptr);
+            ~StreamExtractor(); // removes whatever wasn't committed
+            StreamExtractor(const StreamExtractor&) = delete;
+            StreamExtractor& operator=(const StreamExtractor&) = delete;
+
+            /// Returns false once the archive turned out to be broken or a file couldn't be written
+            bool Feed(const char* data, size_t size);
+            /// True if the whole archive arrived and its central directory matches every extracted entry
+            bool Finish();
+            /// Moves the extracted files over their destinations and records them in the index, only call after Finish
+            /// (and any download check) passed
+            bool Commit();
+            /// Removes every extracted file, the destinations are left as they were
+            void Abort();
+
+            const std::string& Error() const { return m_Error; }
+            const std::vector<EntryInfo>& Entries() const { return m_Entries; }
+            size_t Written() const { return m_Extracted.size(); }
+            size_t Skipped() const { return m_Skipped; }
+    };
+}
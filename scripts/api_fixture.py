@@ -0,0 +1,173 @@
+"""Stand-in for the parts of the GitHub API the installer uses, so both backends can be tried offline.
+
+    python api_fixture.py [port]
+
+then build the installer with `make API_FIXTURE=1` and put "api_root": "http://<this pc>:<port>" in
+sdmc:/switch/HDR_Installer/settings.json. Other builds ignore api_root, the token would go to whatever it names.
+
+Canned channels:
+    blu-dev/HDR-Release-Builds  public, READ. 105 releases so the REST pager needs a second page, the newest
+                                installs a small zip, "many-assets" has more assets than one GraphQL page,
+                                v1.50.0 has a null body
+    blu-dev/HDR-Beta-Builds     private, WRITE. Hidden (404 / null) without a token
+    blu-dev/HDR-Dev-Builds      no access for anyone
+
+Any token is accepted. /graphql answers the query the installer sends (aliases r0, r1... with releases and
+releaseAssets connections) and honours their first: arguments and pageInfo. Every request is logged.
+"""
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import urlparse, parse_qs, quote
+import hashlib, io, json, re, sys, zipfile
+
+port = int(sys.argv[1]) if len(sys.argv) > 1 else 8080
+
+
+def make_zip(files):
+    buffer = io.BytesIO()
+    with zipfile.ZipFile(buffer, 'w', zipfile.ZIP_DEFLATED) as archive:
+        for name, data in files.items():
+            archive.writestr(name, data)
+    return buffer.getvalue()
+
+
+def release(tag, assets, body=''):
+    return {'name': 'HDR ' + tag, 'tag_name': tag, 'body': body, 'assets': assets}
+
+
+def asset(name, data, content_type='application/octet-stream'):
+    return {'name': name, 'data': data, 'content_type': content_type}
+
+
+newest_zip = make_zip({
+    'ultimate/mods/hdr/fixture.txt': b'installed from api_fixture.py\n',
+    'ultimate/mods/hdr/data/params.bin': bytes(range(256)) * 64,
+})
+beta_zip = make_zip({'ultimate/mods/hdr-beta/fixture.txt': b'beta build from api_fixture.py\n'})
+
+release_builds = [release('v1.104.0', [asset('hdr-switch.zip', newest_zip, 'application/zip')],
+                          hashlib.sha256(newest_zip).hexdigest() + '  hdr-switch.zip\n')]
+release_builds.append(release('many-assets', [asset('part-%03d.txt' % i, b'part %d\n' % i, 'text/plain') for i in range(101)]))
+release_builds += [release('v1.%d.0' % i, [], None if i == 50 else '') for i in range(102, -1, -1)]  # GitHub sends null for an empty body
+
+repositories = {
+    'blu-dev/HDR-Release-Builds': {'private': False, 'permission': 'READ', 'releases': release_builds},
+    'blu-dev/HDR-Beta-Builds': {'private': True, 'permission': 'WRITE',
+                                'releases': [release('beta-7', [asset('hdr-beta.zip', beta_zip, 'application/zip')])]},
+    'blu-dev/HDR-Dev-Builds': None,
+}
+
+rest_permissions = {
+    'ADMIN': {'admin': True, 'push': True, 'pull': True},
+    'WRITE': {'admin': False, 'push': True, 'pull': True},
+    'READ': {'admin': False, 'push': False, 'pull': True},
+}
+
+
+class Fixture(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def token(self):
+        value = self.headers.get('Authorization', '')
+        return value.split(' ', 1)[1] if ' ' in value else None
+
+    def visible(self, full_name):
+        repository = repositories.get(full_name)
+        if repository is None or (repository['private'] and self.token() is None):
+            return None
+        return repository
+
+    def root(self):
+        return 'http://' + self.headers.get('Host', '127.0.0.1:%d' % port)
+
+    def send(self, code, payload, content_type='application/json', headers=()):
+        data = payload if isinstance(payload, bytes) else json.dumps(payload).encode()
+        self.send_response(code)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(data)))
+        for name, value in headers:
+            self.send_header(name, value)
+        self.end_headers()
+        self.wfile.write(data)
+
+    def asset_json(self, full_name, tag, item):
+        url = '%s/assets/%s/%s/%s' % (self.root(), full_name, quote(tag), quote(item['name']))
+        return {'url': url, 'browser_download_url': url, 'name': item['name'], 'content_type': item['content_type'], 'size': len(item['data'])}
+
+    def release_json(self, full_name, item, with_assets):
+        answer = {'name': item['name'], 'tag_name': item['tag_name'], 'body': item['body']}
+        if with_assets:
+            answer['assets'] = [self.asset_json(full_name, item['tag_name'], a) for a in item['assets']]
+        return answer
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        parts = [p for p in url.path.split('/') if p]
+        if len(parts) >= 3 and parts[0] == 'repos':
+            full_name = parts[1] + '/' + parts[2]
+            repository = self.visible(full_name)
+            if repository is None:
+                return self.send(404, {'message': 'Not Found'})
+            if len(parts) == 3:
+                answer = {'full_name': full_name, 'private': repository['private']}
+                if self.token() is not None:
+                    answer['permissions'] = rest_permissions[repository['permission']]
+                return self.send(200, answer)
+            if len(parts) == 4 and parts[3] == 'releases':
+                query = parse_qs(url.query)
+                per_page = int(query.get('per_page', ['30'])[0])
+                page = int(query.get('page', ['1'])[0])
+                items = repository['releases'][(page - 1) * per_page:page * per_page]
+                headers = []
+                if page * per_page < len(repository['releases']):
+                    headers.append(('Link', '<%s/repos/%s/releases?per_page=%d&page=%d>; rel="next"' % (self.root(), full_name, per_page, page + 1)))
+                return self.send(200, [self.release_json(full_name, r, True) for r in items], headers=headers)
+            if len(parts) == 6 and parts[3] == 'releases' and parts[4] == 'tags':
+                for item in repository['releases']:
+                    if item['tag_name'] == parts[5]:
+                        return self.send(200, self.release_json(full_name, item, True))
+                return self.send(404, {'message': 'Not Found'})
+        if len(parts) == 5 and parts[0] == 'assets':
+            repository = self.visible(parts[1] + '/' + parts[2])
+            for item in (repository['releases'] if repository else []):
+                if item['tag_name'] == parts[3]:
+                    for a in item['assets']:
+                        if a['name'] == parts[4]:
+                            return self.send(200, a['data'], a['content_type'])
+        self.send(404, {'message': 'Not Found'})
+
+    def do_POST(self):
+        length = int(self.headers.get('Content-Length', '0'))
+        body = self.rfile.read(length)
+        if urlparse(self.path).path != '/graphql':
+            return self.send(404, {'message': 'Not Found'})
+        if self.token() is None:
+            return self.send(401, {'message': 'This endpoint requires you to be authenticated.'})
+        try:
+            query = json.loads(body)['query']
+        except (ValueError, KeyError):
+            return self.send(400, {'message': 'Problems parsing JSON'})
+        release_count = re.search(r'releases\(first: (\d+)', query)
+        asset_count = re.search(r'releaseAssets\(first: (\d+)', query)
+        release_count = int(release_count.group(1)) if release_count else 0
+        asset_count = int(asset_count.group(1)) if asset_count else 0
+        data = {}
+        for alias, owner, name in re.findall(r'(\w+): repository\(owner: "([^"]*)", name: "([^"]*)"\)', query):
+            full_name = owner + '/' + name
+            repository = self.visible(full_name)
+            if repository is None:
+                data[alias] = None
+                continue
+            nodes = []
+            for item in repository['releases'][:release_count]:
+                assets = item['assets'][:asset_count]
+                nodes.append({'name': item['name'], 'tagName': item['tag_name'], 'description': item['body'],
+                              'releaseAssets': {'pageInfo': {'hasNextPage': len(item['assets']) > asset_count},
+                                                'nodes': [{'name': a['name'], 'contentType': a['content_type'], 'size': len(a['data']),
+                                                           'downloadUrl': self.asset_json(full_name, item['tag_name'], a)['url']} for a in assets]}})
+            data[alias] = {'viewerPermission': repository['permission'], 'isPrivate': repository['private'],
+                           'releases': {'pageInfo': {'hasNextPage': len(repository['releases']) > release_count}, 'nodes': nodes}}
+        self.send(200, {'data': data})
+
+
+print('Serving the API fixture on port %d' % port)
+ThreadingHTTPServer(('', port), Fixture).serve_forever()
@@ -0,0 +1,412 @@
+#include "benchmark.hpp"
+#include "hash.hpp"
+#include "tar_stream.hpp"
+#include "utils.hpp"
+#include "zip_extract.hpp"
+#include "zip_io.hpp"
+#include "zip_stream.hpp"
+
+#include <minizip/zip.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+
+namespace bench {
+
+    namespace { // bench detail stuff
+        typedef std::chrono::steady_clock clock;
+
+        static constexpr int64_t PREALLOCATION_FILE_SIZE = 64 * 1024 * 1024;
+        static constexpr size_t PREALLOCATION_RUNS = 3;
+        static constexpr size_t HASHING_DATA_SIZE = 16 * 1024 * 1024;
+        static constexpr size_t HASHING_PASSES = 4;
+        // one big plugin, some medium files and a long tail of small ones, about 100 MiB like a release
+        static constexpr size_t EXTRACTION_LARGE_SIZE = 24 * 1024 * 1024;
+        static constexpr size_t EXTRACTION_MEDIUM_FILES = 16;
+        static constexpr size_t EXTRACTION_MEDIUM_SIZE = 2 * 1024 * 1024;
+        static constexpr size_t EXTRACTION_SMALL_FILES = 1500;
+        static constexpr size_t FORMAT_RUNS = 2;
+        static constexpr size_t IO_RUNS = 2;
+
+        /// Scratch files live next to the settings and are removed as soon as a run is over
+        std::string scratchPath(const std::string& name) {
+            std::string directory = std::string(APP_PATH) + "bench/";
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+            return directory + name;
+        }
+
+        double mibPerSecond(uint64_t bytes, clock::duration elapsed) {
+            double seconds = std::chrono::duration<double>(elapsed).count();
+            return seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0;
+        }
+
+        void printResult(const std::string& label, uint64_t bytes, clock::duration elapsed) {
+            std::cout << label << ": " CYAN << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms, "
+                      << mibPerSecond(bytes, elapsed) << " MiB/s\n" RESET;
+            consoleUpdate(NULL);
+        }
+
+        /// Writes size bytes the way downloadAll does (aligned blocks from the write-behind thread), false if the card refused
+        bool timedWrite(const std::string& path, int64_t size, bool preallocate, clock::duration& elapsed) {
+            clock::time_point start = clock::now();
+            FILE* file = fopen(path.c_str(), "wb");
+            if (file == nullptr)
+                return false;
+            setvbuf(file, nullptr, _IONBF, 0);
+            bool failed = preallocate && !net::preallocate(file, size);
+            {
+                net::WriteBehind writer(net::WRITE_QUEUE_DEPTH, net::WRITE_BUFFER_SIZE);
+                for (int64_t offset = 0; offset < size && !failed; offset += net::WRITE_BUFFER_SIZE) {
+                    char* buffer = writer.Acquire();
+                    size_t length = std::min<int64_t>(net::WRITE_BUFFER_SIZE, size - offset);
+                    memset(buffer, (int)(offset / net::WRITE_BUFFER_SIZE), length);
+                    writer.Submit(file, offset, buffer, length, &failed);
+                }
+                writer.Sync();
+            }
+            fclose(file);
+            elapsed = clock::now() - start;
+            std::error_code error;
+            std::filesystem::remove(path, error);
+            return !failed;
+        }
+
+        std::vector<size_t> syntheticSizes() {
+            std::vector<size_t> sizes = { EXTRACTION_LARGE_SIZE };
+            for (size_t i = 0; i < EXTRACTION_MEDIUM_FILES; i++)
+                sizes.push_back(EXTRACTION_MEDIUM_SIZE);
+            for (size_t i = 0; i < EXTRACTION_SMALL_FILES; i++)
+                sizes.push_back((4 + i * 7919 % 60) * 1024); // 4 to 63 KiB
+            return sizes;
+        }
+
+        std::string syntheticName(size_t i) {
+            return "bench/" + std::to_string(i % 32) + "/" + std::to_string(i) + ".bin";
+        }
+
+        void fillSynthetic(char* data, size_t size, uint32_t& seed) {
+            for (size_t j = 0; j < size; j++) { // 4 bits of noise per byte, deflates to about half like game data does
+                seed = seed * 1664525 + 1013904223;
+                data[j] = 'a' + (seed >> 28);
+            }
+        }
+
+        /// Writes the synthetic release archive, returns its uncompressed size or 0 if the card refused
+        uint64_t writeSyntheticArchive(const std::string& path) {
+            std::vector<size_t> sizes = syntheticSizes();
+            zipFile archive = zipOpen64(path.c_str(), APPEND_STATUS_CREATE);
+            if (archive == nullptr)
+                return 0;
+            std::unique_ptr<char[]> data(new char[EXTRACTION_LARGE_SIZE]);
+            uint32_t seed = 1;
+            uint64_t total = 0;
+            bool ok = true;
+            for (size_t i = 0; i < sizes.size() && ok; i++) {
+                fillSynthetic(data.get(), sizes[i], seed);
+                zip_fileinfo info = {};
+                ok = zipOpenNewFileInZip64(archive, syntheticName(i).c_str(), &info, nullptr, 0, nullptr, 0, nullptr, Z_DEFLATED, Z_DEFAULT_COMPRESSION, 0) == ZIP_OK
+                    && zipWriteInFileInZip(archive, data.get(), sizes[i]) == ZIP_OK
+                    && zipCloseFileInZip(archive) == ZIP_OK;
+                total += sizes[i];
+            }
+            zipClose(archive, nullptr);
+            return ok ? total : 0;
+        }
+
+        /// Compresses size bytes into file, ZSTD_e_end closes the frame
+        bool compressTo(ZSTD_CCtx* context, FILE* file, const char* data, size_t size, ZSTD_EndDirective mode, char* out, size_t out_size) {
+            ZSTD_inBuffer input = { data, size, 0 };
+            size_t left;
+            do {
+                ZSTD_outBuffer output = { out, out_size, 0 };
+                left = ZSTD_compressStream2(context, &output, &input, mode);
+                if (ZSTD_isError(left) || fwrite(out, 1, output.pos, file) != output.pos)
+                    return false;
+            } while (mode == ZSTD_e_end ? left != 0 : input.pos < input.size);
+            return true;
+        }
+
+        /// A ustar header for a regular file
+        void tarHeader(char* block, const std::string& name, uint64_t size) {
+            memset(block, 0, tar::BLOCK_SIZE);
+            strncpy(block, name.c_str(), 100);
+            snprintf(block + 100, 8, "%07o", 0644);
+            snprintf(block + 108, 8, "%07o", 0);
+            snprintf(block + 116, 8, "%07o", 0);
+            snprintf(block + 124, 12, "%011llo", (unsigned long long)size);
+            snprintf(block + 136, 12, "%011o", 0);
+            block[156] = '0';
+            memcpy(block + 257, "ustar\0" "00", 8);
+            memset(block + 148, ' ', 8);
+            unsigned sum = 0;
+            for (size_t i = 0; i < tar::BLOCK_SIZE; i++)
+                sum += (uint8_t)block[i];
+            snprintf(block + 148, 8, "%06o", sum); // six digits, a NUL and the space left from above
+        }
+
+        /// The same files as writeSyntheticArchive as a .tar.zst, returns the uncompressed size or 0 if the card refused
+        uint64_t writeSyntheticTarZst(const std::string& path) {
+            std::vector<size_t> sizes = syntheticSizes();
+            FILE* file = fopen(path.c_str(), "wb");
+            if (file == nullptr)
+                return 0;
+            std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+            ZSTD_CCtx_setParameter(context.get(), ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+            ZSTD_CCtx_setParameter(context.get(), ZSTD_c_checksumFlag, 1);
+            size_t out_size = ZSTD_CStreamOutSize();
+            std::unique_ptr<char[]> out(new char[out_size]);
+            std::unique_ptr<char[]> data(new char[EXTRACTION_LARGE_SIZE + tar::BLOCK_SIZE]);
+            uint32_t seed = 1;
+            uint64_t total = 0;
+            bool ok = true;
+            for (size_t i = 0; i < sizes.size() && ok; i++) {
+                tarHeader(data.get(), syntheticName(i), sizes[i]);
+                fillSynthetic(data.get() + tar::BLOCK_SIZE, sizes[i], seed);
+                size_t padded = (sizes[i] + tar::BLOCK_SIZE - 1) / tar::BLOCK_SIZE * tar::BLOCK_SIZE;
+                memset(data.get() + tar::BLOCK_SIZE + sizes[i], 0, padded - sizes[i]);
+                ok = compressTo(context.get(), file, data.get(), tar::BLOCK_SIZE + padded, ZSTD_e_continue, out.get(), out_size);
+                total += sizes[i];
+            }
+            memset(data.get(), 0, 2 * tar::BLOCK_SIZE); // end of archive
+            ok = ok && compressTo(context.get(), file, data.get(), 2 * tar::BLOCK_SIZE, ZSTD_e_end, out.get(), out_size);
+            ok = fclose(file) == 0 && ok;
+            return ok ? total : 0;
+        }
+
+        /// Feeds a zip on the card to the streaming extractor in download sized chunks, like downloadRelease does
+        bool streamZip(const std::string& archive, const std::string& root, std::string& message) {
+            zip::StreamExtractor extractor(root);
+            FILE* file = fopen(archive.c_str(), "rb");
+            if (file == nullptr)
+                return false;
+            std::unique_ptr<char[]> buffer(new char[net::WRITE_BUFFER_SIZE]);
+            bool ok = true;
+            size_t read;
+            while (ok && (read = fread(buffer.get(), 1, net::WRITE_BUFFER_SIZE, file)) > 0)
+                ok = extractor.Feed(buffer.get(), read);
+            fclose(file);
+            ok = ok && extractor.Finish() && extractor.Commit();
+            message = extractor.Error();
+            return ok;
+        }
+
+        uint64_t fileSize(const std::string& path) {
+            std::error_code error;
+            uint64_t size = std::filesystem::file_size(path, error);
+            return error ? 0 : size;
+        }
+
+        bool readWhole(const std::string& path, std::string& data) {
+            data.assign(fileSize(path), '\0');
+            FILE* file = fopen(path.c_str(), "rb");
+            bool ok = file != nullptr && !data.empty() && fread(data.data(), 1, data.size(), file) == data.size();
+            if (file != nullptr)
+                fclose(file);
+            return ok;
+        }
+    }
+
+    std::vector<Benchmark> getBenchmarks() {
+        return {
+            { "Preallocation", "Writes a 64 MiB file through the download write path, growing it one block at a time vs preallocating it.", preallocation },
+            { "Hashing", "Hashes 64 MiB in memory with the SHA-256 and CRC32 kernels, in the chunk sizes each path feeds them.", hashing },
+            { "Zip extraction", "Extracts a 100 MiB archive of 1500+ files with elzip and with the parallel extractor on 1 to 3 cores.", extraction },
+            { "Zip vs tar.zst", "Installs the same 100 MiB of files from a zip (deflate) and from a tar.zst through the streaming extractors.", archiveFormats },
+            { "Zip I/O backends", "Extracts the 100 MiB archive in parallel reading it through minizip's stdio, a read-ahead buffer and from RAM.", zipIo }
+        };
+    }
+
+    void preallocation() {
+        std::string path = scratchPath("preallocation.bin");
+        clock::duration totals[2] = { clock::duration::zero(), clock::duration::zero() };
+        for (size_t run = 0; run < PREALLOCATION_RUNS; run++) {
+            for (int preallocate = 0; preallocate < 2; preallocate++) { // alternating, so card caching favours neither
+                clock::duration elapsed;
+                if (!timedWrite(path, PREALLOCATION_FILE_SIZE, preallocate, elapsed)) {
+                    std::cout << RED "Writing " << path << " failed, is the card full?\n" RESET;
+                    return;
+                }
+                printResult(std::string(preallocate ? "Preallocated" : "Growing     ") + " run " + std::to_string(run + 1), PREALLOCATION_FILE_SIZE, elapsed);
+                totals[preallocate] += elapsed;
+            }
+        }
+        std::cout << "\n";
+        printResult(GREEN "Growing average" RESET, PREALLOCATION_FILE_SIZE, totals[0] / PREALLOCATION_RUNS);
+        printResult(GREEN "Preallocated average" RESET, PREALLOCATION_FILE_SIZE, totals[1] / PREALLOCATION_RUNS);
+    }
+
+    void hashing() {
+        struct Path {
+            const char* name;
+            size_t chunk;
+        };
+        static const Path paths[] = {
+            { "Download (write buffer)", net::WRITE_BUFFER_SIZE },
+            { "Extraction (inflate output)", 64 * 1024 },
+            { "Verification (file reads)", 1024 * 1024 }
+        };
+        std::unique_ptr<uint8_t[]> data(new uint8_t[HASHING_DATA_SIZE]);
+        for (size_t i = 0; i < HASHING_DATA_SIZE; i++)
+            data[i] = (uint8_t)(i * 2654435761u >> 24);
+        uint64_t bytes = HASHING_DATA_SIZE * HASHING_PASSES;
+
+        for (int portable = 0; portable < 2; portable++) {
+            hash::forcePortable(portable);
+            std::cout << GREEN "\nSHA-256: " << hash::sha256Implementation() << ", CRC32: " << hash::crc32Implementation() << "\n" RESET;
+            for (const Path& path : paths) {
+                clock::time_point start = clock::now();
+                hash::Sha256 sha256;
+                for (size_t pass = 0; pass < HASHING_PASSES; pass++)
+                    for (size_t offset = 0; offset < HASHING_DATA_SIZE; offset += path.chunk)
+                        sha256.Update(data.get() + offset, std::min(path.chunk, HASHING_DATA_SIZE - offset));
+                uint8_t digest[hash::SHA256_SIZE];
+                sha256.Finish(digest);
+                printResult(std::string("SHA-256 ") + path.name, bytes, clock::now() - start);
+
+                start = clock::now();
+                uint32_t crc = 0;
+                for (size_t pass = 0; pass < HASHING_PASSES; pass++)
+                    for (size_t offset = 0; offset < HASHING_DATA_SIZE; offset += path.chunk)
+                        crc = hash::crc32(crc, data.get() + offset, std::min(path.chunk, HASHING_DATA_SIZE - offset));
+                printResult(std::string("CRC32   ") + path.name, bytes, clock::now() - start);
+            }
+        }
+        hash::forcePortable(false);
+    }
+
+    void extraction() {
+        std::string archive = scratchPath("extraction.zip");
+        std::string target = scratchPath("extracted/");
+        std::cout << "Writing the archive...\n";
+        consoleUpdate(NULL);
+        uint64_t bytes = writeSyntheticArchive(archive);
+        std::error_code error;
+        if (bytes == 0) {
+            std::cout << RED "Writing " << archive << " failed, is the card full?\n" RESET;
+            std::filesystem::remove(archive, error);
+            return;
+        }
+
+        clock::time_point start = clock::now();
+        elz::extractZip(archive, target);
+        printResult("elzip     ", bytes, clock::now() - start);
+        std::filesystem::remove_all(target, error);
+        for (size_t threads = 1; threads <= zip::APPLICATION_CORES; threads++) {
+            zip::ExtractStats stats;
+            std::string message;
+            start = clock::now();
+            bool ok = zip::extractParallel(archive, target, threads, &stats, &message);
+            clock::duration elapsed = clock::now() - start;
+            std::filesystem::remove_all(target, error);
+            if (!ok) {
+                std::cout << "Extraction failed: " RED << message << "\n" RESET;
+                break;
+            }
+            printResult(std::to_string(threads) + (threads == 1 ? " thread  " : " threads "), bytes, elapsed);
+        }
+        std::filesystem::remove(archive, error);
+    }
+
+    void archiveFormats() {
+        std::string zip_archive = scratchPath("formats.zip");
+        std::string tar_archive = scratchPath("formats.tar.zst");
+        std::string target = scratchPath("extracted/");
+        std::cout << "Writing the archives...\n";
+        consoleUpdate(NULL);
+        uint64_t bytes = writeSyntheticArchive(zip_archive);
+        bytes = bytes != 0 && writeSyntheticTarZst(tar_archive) == bytes ? bytes : 0;
+        std::error_code error;
+        if (bytes == 0) {
+            std::cout << RED "Writing the archives failed, is the card full?\n" RESET;
+            std::filesystem::remove(zip_archive, error);
+            std::filesystem::remove(tar_archive, error);
+            return;
+        }
+        std::cout << "zip " << fileSize(zip_archive) / 1024 << " KiB, tar.zst " << fileSize(tar_archive) / 1024 << " KiB\n";
+
+        clock::duration totals[2] = { clock::duration::zero(), clock::duration::zero() };
+        for (size_t run = 0; run < FORMAT_RUNS; run++) {
+            for (int zstd = 0; zstd < 2; zstd++) { // alternating, so card caching favours neither
+                std::string message;
+                clock::time_point start = clock::now();
+                bool ok = zstd ? tar::extractArchive(tar_archive, target, nullptr, nullptr, &message) : streamZip(zip_archive, target, message);
+                clock::duration elapsed = clock::now() - start;
+                std::filesystem::remove_all(target, error);
+                if (!ok) {
+                    std::cout << "Extraction failed: " RED << message << "\n" RESET;
+                    std::filesystem::remove(zip_archive, error);
+                    std::filesystem::remove(tar_archive, error);
+                    return;
+                }
+                printResult(std::string(zstd ? "tar/zstd   " : "zip/deflate") + " run " + std::to_string(run + 1), bytes, elapsed);
+                totals[zstd] += elapsed;
+            }
+        }
+        std::cout << "\n";
+        printResult(GREEN "zip/deflate average" RESET, bytes, totals[0] / FORMAT_RUNS);
+        printResult(GREEN "tar/zstd average" RESET, bytes, totals[1] / FORMAT_RUNS);
+        std::filesystem::remove(zip_archive, error);
+        std::filesystem::remove(tar_archive, error);
+    }
+
+    void zipIo() {
+        std::string archive = scratchPath("io.zip");
+        std::string target = scratchPath("extracted/");
+        std::cout << "Writing the archive...\n";
+        consoleUpdate(NULL);
+        uint64_t bytes = writeSyntheticArchive(archive);
+        std::error_code error;
+        if (bytes == 0) {
+            std::cout << RED "Writing " << archive << " failed, is the card full?\n" RESET;
+            std::filesystem::remove(archive, error);
+            return;
+        }
+        std::string data;
+        clock::time_point start = clock::now();
+        if (!readWhole(archive, data)) {
+            std::cout << RED "Reading " << archive << " into memory failed\n" RESET;
+            std::filesystem::remove(archive, error);
+            return;
+        }
+        printResult("Loading the zip to RAM", data.size(), clock::now() - start);
+
+        zip::MemoryArchive memory = { data.data(), data.size() };
+        zlib_filefunc64_def buffered;
+        zlib_filefunc64_def in_memory;
+        zip::fillBufferedFileFunctions(&buffered);
+        zip::fillMemoryFileFunctions(&in_memory, &memory);
+        const zlib_filefunc64_def* backends[] = { nullptr, &buffered, &in_memory };
+        const char* names[] = { "stdio   ", "buffered", "memory  " };
+        for (size_t threads : { (size_t)1, zip::APPLICATION_CORES }) {
+            clock::duration totals[3] = { clock::duration::zero(), clock::duration::zero(), clock::duration::zero() };
+            uint64_t list_ms[3] = { 0, 0, 0 };
+            for (size_t run = 0; run < IO_RUNS; run++) {
+                for (size_t backend = 0; backend < 3; backend++) { // alternating, so card caching favours none of them
+                    zip::ExtractStats stats;
+                    std::string message;
+                    start = clock::now();
+                    bool ok = zip::extractParallel(archive, target, threads, &stats, &message, nullptr, backends[backend]);
+                    clock::duration elapsed = clock::now() - start;
+                    std::filesystem::remove_all(target, error);
+                    if (!ok) {
+                        std::cout << "Extraction failed: " RED << message << "\n" RESET;
+                        std::filesystem::remove(archive, error);
+                        return;
+                    }
+                    totals[backend] += elapsed;
+                    list_ms[backend] += stats.list_ms;
+                }
+            }
+            std::cout << "\n";
+            for (size_t backend = 0; backend < 3; backend++)
+                printResult(std::string(names[backend]) + " " + std::to_string(threads) + (threads == 1 ? " thread, " : " threads, ") + "directory "
+                            + std::to_string(list_ms[backend] / IO_RUNS) + " ms", bytes, totals[backend] / IO_RUNS);
+        }
+        std::filesystem::remove(archive, error);
+    }
+}
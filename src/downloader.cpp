@@ -0,0 +1,638 @@
+#include "downloader.hpp"
+#include "hash.hpp"
+#include "json.hpp"
+#include "write_behind.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+using json = nlohmann::json;
+
+namespace net {
+
+    namespace { // downloader detail stuff
+        /// A byte range of the file and how much of it is on disk
+        struct Segment {
+            curl_off_t offset;
+            curl_off_t length;      // 0 for a single stream of unknown size
+            curl_off_t received;    // handed to the writer, only touched by the network thread
+            curl_off_t durable;     // on the card, advanced by the writer thread under DownloadState::progress_lock
+            uint32_t crc;           // of the durable bytes, same
+        };
+
+        /// Everything downloadAll tracks per download, the segments are what the sidecar stores
+        struct DownloadState {
+            size_t parts_left = 0;
+            bool failed = false;
+            bool restart = false;   // the partial file is useless (server refused it or changed it), don't keep it
+            std::string etag;
+            curl_off_t size = 0;
+            std::vector<Segment> segments;
+            hash::Sha256 sha256;    // only fed when there is a single segment, SHA-256 can't be combined like CRCs
+            std::mutex progress_lock; // durable, crc and sha256 are fed by the writer while the sidecar may be saved
+        };
+
+        /// One transfer of a download, either the whole body or the rest of one segment
+        struct Part {
+            std::unique_ptr<CURL_builder> curl;
+            FILE* file;
+            Download* download;
+            DownloadState* state;
+            Segment* segment;
+            bool ranged;
+            bool checked;           // the status code was verified before the first byte got written
+            WriteBehind* writer;
+            char* buffer;           // being filled, nullptr until the first byte arrives
+            size_t filled;
+            curl_off_t position;    // file offset of buffer[0]
+            bool write_failed;      // set by the writer thread, only read by the network thread once closed
+            bool finished;          // curl was done with it, result and complete are set
+            CURLcode result;
+            bool complete;          // every byte of the segment arrived
+            std::atomic<bool> closed; // the writer got through every job of the part and closed its file
+        };
+
+        /// Splitting gives up on SHA-256 and sinks need the bytes in order, so those downloads are a single stream
+        size_t segmentsWanted(const Download& download) {
+            return download.expected_sha256.empty() && download.sink == nullptr ? download.segments : 1;
+        }
+
+        /// Feeds the hashes (and the sink) from the writer thread once the bytes are on the card, the part is kept alive until
+        /// it is closed. After a failed write nothing more counts as durable, the sidecar must not claim bytes behind a hole
+        bool partWritten(void* user_data, const char* data, size_t size) {
+            Part& part = *(Part*)user_data;
+            if (part.write_failed) // set by this thread, the writer runs one job at a time
+                return false;
+            {
+                std::lock_guard<std::mutex> guard(part.state->progress_lock);
+                part.segment->crc = hash::crc32(part.segment->crc, data, size);
+                part.segment->durable += size;
+                if (part.state->segments.size() == 1)
+                    part.state->sha256.Update(data, size);
+            }
+            if (part.download->sink != nullptr && !part.download->sink(part.download->sink_data, data, size)) {
+                part.download->sink_failed = true; // read by the network thread once the part is closed
+                return false;
+            }
+            return true;
+        }
+
+        /// Last job of every part, the jobs before it are done so the file can be closed and the part handed back
+        bool partClosed(void* user_data, const char* data, size_t size) {
+            Part& part = *(Part*)user_data;
+            if (part.file != nullptr && fclose(part.file) != 0)
+                part.write_failed = true;
+            part.closed.store(true, std::memory_order_release);
+            return true; // the writer mustn't touch the part after this, the network thread may free it any moment
+        }
+
+        std::mutex stats_lock;
+        WriteStats write_stats = { 0, 0, 0, 0, 0, 0, 0 };
+
+        /// Hands the filled part of the buffer to the writer
+        void submitPart(Part& part) {
+            if (part.buffer == nullptr)
+                return;
+            if (part.filled > 0)
+                part.writer->Submit(part.file, part.position, part.buffer, part.filled, &part.write_failed, partWritten, &part);
+            else
+                part.writer->Release(part.buffer);
+            part.segment->received += part.filled;
+            part.position += part.filled;
+            part.buffer = nullptr;
+            part.filled = 0;
+        }
+
+        /// Empty for downloads going to a sink, they have neither a file nor a sidecar
+        std::string sidecarPath(const Download& download) { return download.path.empty() ? "" : download.path + PARTIAL_SUFFIX; }
+
+        void removeFile(const std::string& path) {
+            if (path.empty())
+                return;
+            std::error_code error;
+            std::filesystem::remove(path, error);
+        }
+
+        /// Only downloads with a validator and a known size can be resumed safely
+        bool resumable(const DownloadState& state) {
+            return !state.etag.empty() && state.size > 0 && !state.restart;
+        }
+
+        /// Only claims what the writer reported durable, so it can be saved while writes are still queued
+        void saveSidecar(const Download& download, DownloadState& state) {
+            json segments = json::array();
+            json sidecar = {
+                { "url", download.url },
+                { "etag", state.etag },
+                { "size", state.size }
+            };
+            {
+                std::lock_guard<std::mutex> guard(state.progress_lock);
+                for (const Segment& segment : state.segments)
+                    segments.push_back({ segment.offset, segment.length > 0 ? segment.length : state.size, segment.durable, segment.crc });
+                if (state.segments.size() == 1) // the hash picks up where it stopped instead of reading the partial file again
+                    sidecar["sha256_state"] = state.sha256.SaveState();
+            }
+            sidecar["segments"] = segments;
+            std::ofstream file(sidecarPath(download), std::ios_base::out | std::ios_base::trunc);
+            file << sidecar.dump();
+        }
+
+        /// Reads the sidecar of an earlier attempt, false if there is none or it doesn't belong to this url and file
+        bool loadSidecar(const Download& download, DownloadState& state) {
+            std::ifstream file(sidecarPath(download), std::ios_base::in);
+            if (!file.is_open())
+                return false;
+            json sidecar;
+            try { sidecar = json::parse(file); }
+            catch (json::parse_error& e) { return false; }
+            if (!sidecar.is_object() || !sidecar["url"].is_string() || sidecar["url"] != download.url || !sidecar["etag"].is_string()
+                || !sidecar["size"].is_number_integer() || !sidecar["segments"].is_array())
+                return false;
+            state.etag = sidecar["etag"].get<std::string>();
+            state.size = sidecar["size"].get<curl_off_t>();
+            state.segments.clear();
+            std::error_code error;
+            curl_off_t on_disk = std::filesystem::file_size(download.path, error);
+            if (error)
+                return false;
+            for (auto& entry : sidecar["segments"]) {
+                if (!entry.is_array() || entry.size() != 4 || !entry[0].is_number_integer() || !entry[1].is_number_integer() || !entry[2].is_number_integer() || !entry[3].is_number_unsigned())
+                    return false;
+                Segment segment = { entry[0].get<curl_off_t>(), entry[1].get<curl_off_t>(), entry[2].get<curl_off_t>(), entry[2].get<curl_off_t>(), entry[3].get<uint32_t>() };
+                if (segment.length <= 0 || segment.received < 0 || segment.received > segment.length || segment.offset + segment.received > on_disk)
+                    return false;
+                state.segments.push_back(segment);
+            }
+            if (state.segments.size() == 1 && (!sidecar["sha256_state"].is_string() || !state.sha256.LoadState(sidecar["sha256_state"].get<std::string>())))
+                return false;
+            if (state.segments.size() > 1 && !download.expected_sha256.empty()) // was split before there was a digest to check
+                return false;
+            return resumable(state) && !state.segments.empty();
+        }
+
+        size_t partWrite(char* to_write, size_t size, size_t byte_count, void* user_data) {
+            Part& part = *(Part*)user_data;
+            Segment& segment = *part.segment;
+            size_t length = size * byte_count;
+            if (!part.checked && part.ranged) { // a server ignoring the range (or If-Range) would write the whole file at our offset
+                long http_code = 0;
+                curl_easy_getinfo(part.curl->request, CURLINFO_RESPONSE_CODE, &http_code);
+                if (http_code != 206) {
+                    part.state->restart = true;
+                    return 0;
+                }
+            }
+            part.checked = true;
+            if (segment.length > 0 && segment.received + (curl_off_t)(part.filled + length) > segment.length) {
+                part.state->restart = true;
+                return 0;
+            }
+            size_t buffer_size = part.writer->BufferSize();
+            size_t copied = 0;
+            while (copied < length) {
+                if (part.buffer == nullptr)
+                    part.buffer = part.writer->Acquire(); // only blocks when the card is behind by a whole queue
+                size_t capacity = buffer_size - (size_t)(part.position % buffer_size); // every buffer ends on an aligned offset
+                size_t chunk = std::min(length - copied, capacity - part.filled);
+                memcpy(part.buffer + part.filled, to_write + copied, chunk);
+                part.filled += chunk;
+                copied += chunk;
+                if (part.filled == capacity)
+                    submitPart(part);
+            }
+            part.download->now += length;
+            return length;
+        }
+
+        /// Remembers the validator and size of a plain stream, so it can be resumed if it gets interrupted
+        size_t partHeader(char* header, size_t size, size_t byte_count, void* user_data) {
+            Part& part = *(Part*)user_data;
+            size_t length = size * byte_count;
+            if (part.ranged)
+                return length;
+            std::string line(header, length);
+            std::transform(line.begin(), line.end(), line.begin(), ::tolower);
+            size_t value_end = line.find_last_not_of(" \t\r\n");
+            if (line.rfind("http/", 0) == 0) { // a new response (after a redirect), forget what the previous one said
+                part.state->etag.clear();
+                part.state->size = 0;
+            }
+            else if (line.rfind("etag:", 0) == 0 && value_end != std::string::npos) {
+                size_t value_start = line.find_first_not_of(" \t", 5);
+                if (value_start != std::string::npos && value_start <= value_end)
+                    part.state->etag = std::string(header + value_start, value_end - value_start + 1); // ETags are case sensitive
+            }
+            else if (line.rfind("content-length:", 0) == 0)
+                part.state->size = strtoll(line.c_str() + 15, nullptr, 10);
+            else if (value_end == std::string::npos && part.download->preallocate && part.file != nullptr && part.state->size > 0) { // end of the headers, nothing is queued for this file yet
+                long http_code = 0;
+                curl_easy_getinfo(part.curl->request, CURLINFO_RESPONSE_CODE, &http_code);
+                if (http_code == 200)
+                    preallocate(part.file, part.state->size);
+            }
+            return length;
+        }
+
+        int transferProgress(void* user_data, curl_off_t total_dl, curl_off_t current_dl, curl_off_t total_up, curl_off_t current_up) {
+            Part& part = *(Part*)user_data;
+            if (!part.ranged) // ranged downloads know their size from the probe
+                part.download->total = total_dl;
+            return 0;
+        }
+
+        size_t discardWrite(char* to_write, size_t size, size_t byte_count, void* user_data) {
+            return size * byte_count;
+        }
+
+        struct Probe {
+            CURLcode result;
+            long http_code;
+            curl_off_t size;
+            std::string etag;
+            std::string effective_url;
+        };
+
+        /// Content-Range: bytes 0-0/123456 and the ETag of the final response
+        size_t probeHeader(char* header, size_t size, size_t byte_count, void* user_data) {
+            Probe& probe = *(Probe*)user_data;
+            size_t length = size * byte_count;
+            std::string line(header, length);
+            std::string lower = line;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            size_t value_end = line.find_last_not_of(" \t\r\n");
+            if (lower.rfind("content-range:", 0) == 0) {
+                size_t slash = lower.find('/');
+                if (slash != std::string::npos)
+                    probe.size = strtoll(lower.c_str() + slash + 1, nullptr, 10);
+            }
+            else if (lower.rfind("etag:", 0) == 0 && value_end != std::string::npos) {
+                size_t value_start = line.find_first_not_of(" \t", 5);
+                if (value_start != std::string::npos && value_start <= value_end)
+                    probe.etag = line.substr(value_start, value_end - value_start + 1);
+            }
+            return length;
+        }
+
+        /// Asks for the first byte to learn the size, the ETag and whether ranges are honoured. effective_url is where the
+        /// redirects ended up (the CDN), so the segments don't each go through the API redirect again
+        bool probeRanges(const Download& download, Probe& probe) {
+            CURL_builder curl;
+            if (!curl)
+                return false;
+            probe = { CURLE_FAILED_INIT, 0, 0, "", "" };
+            probe.result =
+                curl.SetHeaders(download.headers)
+                    .SetURL(download.url)
+                    .SetOPT(CURLOPT_RANGE, "0-0")
+                    .SetOPT(CURLOPT_WRITEFUNCTION, discardWrite)
+                    .SetOPT(CURLOPT_HEADERDATA, &probe)
+                    .SetOPT(CURLOPT_HEADERFUNCTION, probeHeader)
+                    .SetOPT(CURLOPT_USERAGENT, "HDR-User")
+                    .SetOPT(CURLOPT_FOLLOWLOCATION, 1L)
+                    .SetOPT(CURLOPT_FAILONERROR, 1L)
+                    .SetOPT(CURLOPT_SSL_VERIFYPEER, 0L)
+                    .SetOPT(CURLOPT_SSL_VERIFYHOST, 0L)
+                    .Perform();
+            curl_easy_getinfo(curl.request, CURLINFO_RESPONSE_CODE, &probe.http_code);
+            char* url = nullptr;
+            curl_easy_getinfo(curl.request, CURLINFO_EFFECTIVE_URL, &url);
+            if (probe.result != CURLE_OK || probe.http_code != 206 || probe.size <= 0 || url == nullptr)
+                return false;
+            probe.effective_url = url;
+            return true;
+        }
+
+        /// The token is only meant for the API, the CDN url is already signed
+        std::vector<std::string> withoutAuthorization(const std::vector<std::string>& headers) {
+            std::vector<std::string> ret;
+            for (const std::string& header : headers) {
+                std::string name = header.substr(0, header.find(':'));
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                if (name != "authorization")
+                    ret.push_back(header);
+            }
+            return ret;
+        }
+
+        bool addPart(CURLM* multi, WriteBehind& writer, Download& download, DownloadState& state, Segment& segment, bool ranged, const std::string& url, std::vector<std::string> headers, std::vector<std::unique_ptr<Part>>& parts) {
+            std::unique_ptr<Part> part(new Part{ std::make_unique<CURL_builder>(), nullptr, &download, &state, &segment, ranged, false, &writer, nullptr, 0, segment.offset + segment.received,
+                                                 false, false, CURLE_FAILED_INIT, false, false });
+            if (!*part->curl)
+                return false;
+            if (download.sink == nullptr) {
+                part->file = fopen(download.path.c_str(), ranged ? "r+b" : "wb");
+                if (part->file == nullptr)
+                    return false;
+                setvbuf(part->file, nullptr, _IONBF, 0); // the writer only ever writes whole buffers, stdio buffering would just copy them again
+            }
+            if (ranged && !state.etag.empty())
+                headers.push_back("If-Range: " + state.etag); // a changed file comes back as a 200, which partWrite refuses
+            part->curl->SetHeaders(headers)
+                .SetURL(url)
+                .SetOPT(CURLOPT_WRITEDATA, part.get())
+                .SetOPT(CURLOPT_WRITEFUNCTION, partWrite)
+                .SetOPT(CURLOPT_HEADERDATA, part.get())
+                .SetOPT(CURLOPT_HEADERFUNCTION, partHeader)
+                .SetOPT(CURLOPT_USERAGENT, "HDR-User")
+                .SetOPT(CURLOPT_FOLLOWLOCATION, 1L)
+                .SetOPT(CURLOPT_FAILONERROR, 1L) // an error page must not end up in the file
+                .SetOPT(CURLOPT_SSL_VERIFYPEER, 0L)
+                .SetOPT(CURLOPT_SSL_VERIFYHOST, 0L)
+                .SetOPT(CURLOPT_NOPROGRESS, 0L)
+                .SetOPT(CURLOPT_XFERINFODATA, part.get())
+                .SetOPT(CURLOPT_XFERINFOFUNCTION, transferProgress);
+            if (ranged) {
+                std::string range = std::to_string(segment.offset + segment.received) + "-" + std::to_string(segment.offset + segment.length - 1);
+                part->curl->SetOPT(CURLOPT_RANGE, range.c_str());
+            }
+            curl_multi_add_handle(multi, part->curl->request);
+            parts.push_back(std::move(part));
+            return true;
+        }
+
+        /// Lays out the segments of a fresh download and sizes its file, false if the file can't be created
+        bool startFresh(Download& download, DownloadState& state, const Probe& probe, bool probed) {
+            removeFile(sidecarPath(download));
+            state.etag = probed ? probe.etag : "";
+            state.size = probed ? probe.size : 0;
+            state.segments.clear();
+            state.sha256.Reset();
+            size_t segments = probed ? std::min<curl_off_t>(segmentsWanted(download), probe.size / SEGMENT_MIN_SIZE) : 1;
+            if (segments < 2) {
+                state.segments.push_back({ 0, 0, 0, 0, 0 });
+                return true;
+            }
+            // every segment opens the file for update, so it has to exist first
+            FILE* file = fopen(download.path.c_str(), "wb");
+            if (file == nullptr || (download.preallocate && !preallocate(file, probe.size))) {
+                if (file != nullptr)
+                    fclose(file);
+                return false;
+            }
+            fclose(file);
+            curl_off_t segment_size = probe.size / segments;
+            for (size_t i = 0; i < segments; i++) {
+                curl_off_t offset = segment_size * i;
+                state.segments.push_back({ offset, (i == segments - 1) ? probe.size - offset : segment_size, 0, 0, 0 });
+            }
+            return true;
+        }
+
+        /// Starts every unfinished part of a download, returns the number of parts that were added. Sets state.failed
+        /// when the download can't be started at all
+        size_t start(CURLM* multi, WriteBehind& writer, Download& download, DownloadState& state, std::vector<std::unique_ptr<Part>>& parts) {
+            Probe probe;
+            state.restart = download.sink != nullptr; // what a sink already consumed can't be fed again, nothing to resume
+            bool resuming = !state.restart && loadSidecar(download, state);
+            bool probed = (resuming || segmentsWanted(download) > 1) && probeRanges(download, probe);
+            if (resuming && !probed && probe.result != CURLE_OK && probe.http_code < 400) { // offline, keep the partial file for later
+                download.result = probe.result;
+                state.failed = true;
+                return 0;
+            }
+            if (resuming && (!probed || probe.etag != state.etag || probe.size != state.size)) // changed on the server, start over
+                resuming = false;
+            if (!resuming && !startFresh(download, state, probe, probed)) {
+                download.result = CURLE_WRITE_ERROR;
+                state.failed = true;
+                state.restart = true;
+                return 0;
+            }
+
+            std::error_code error;
+            if (resuming && download.preallocate && (curl_off_t)std::filesystem::file_size(download.path, error) < state.size)
+                std::filesystem::resize_file(download.path, state.size, error);
+            download.resumed = resuming;
+            download.total = state.size;
+            download.now = 0;
+            for (const Segment& segment : state.segments)
+                download.now += segment.received;
+            bool ranged = state.segments[0].length > 0;
+            const std::string& url = probed ? probe.effective_url : download.url;
+            std::vector<std::string> headers = probed ? withoutAuthorization(download.headers) : download.headers;
+            size_t added = 0;
+            for (Segment& segment : state.segments) {
+                if (ranged && segment.received == segment.length)
+                    continue;
+                if (!addPart(multi, writer, download, state, segment, ranged, url, headers, parts)) {
+                    download.result = CURLE_WRITE_ERROR;
+                    state.failed = true; // the parts that did start keep the partial file resumable
+                    break;
+                }
+                added++;
+            }
+            return added;
+        }
+
+        /// Stops the transfer and moves the part to closing, the writer closes its file after the last of its buffers
+        void dropPart(CURLM* multi, std::vector<std::unique_ptr<Part>>& parts, size_t index, std::vector<std::unique_ptr<Part>>& closing) {
+            Part& part = *parts[index];
+            curl_multi_remove_handle(multi, part.curl->request);
+            submitPart(part); // whatever did arrive is still valid, a resume continues after it
+            part.writer->Submit(nullptr, 0, part.writer->Acquire(), 0, &part.write_failed, partClosed, &part);
+            closing.push_back(std::move(parts[index]));
+            parts.erase(parts.begin() + index);
+        }
+    }
+
+    bool downloadAll(std::vector<Download>& downloads, size_t max_concurrent, DownloadProgressCallback on_progress, DownloadCompleteCallback on_complete, void* user_data) {
+        CURLM* multi = curl_multi_init();
+        if (multi == nullptr)
+            return false;
+        if (max_concurrent < 1)
+            max_concurrent = 1;
+
+        bool ok = true;
+        bool cancelled = false;
+        size_t next = 0;
+        size_t finished = 0;
+        size_t downloading = 0;
+        std::vector<DownloadState> states(downloads.size());
+        WriteBehind writer(WRITE_QUEUE_DEPTH, WRITE_BUFFER_SIZE);
+        std::vector<std::unique_ptr<Part>> parts;
+        std::vector<std::unique_ptr<Part>> closing; // dropped, waiting for the writer to get through their buffers
+        auto last_sidecar_save = std::chrono::steady_clock::now();
+
+        // a download is over once its last part is gone, failed downloads take their other parts down with them
+        auto finishDownload = [&](Download& download) {
+            DownloadState& state = states[&download - downloads.data()];
+            download.done = true;
+            finished++;
+            downloading--;
+            if (state.failed) {
+                if (resumable(state))
+                    saveSidecar(download, state);
+                else {
+                    removeFile(download.path);
+                    removeFile(sidecarPath(download));
+                }
+                ok = false;
+                return;
+            }
+            removeFile(sidecarPath(download));
+            download.crc32 = 0;
+            for (const Segment& segment : state.segments) // every part is closed, the writer is done with them
+                download.crc32 = hash::crc32Combine(download.crc32, segment.crc, segment.durable);
+            if (state.segments.size() == 1) {
+                uint8_t digest[hash::SHA256_SIZE];
+                state.sha256.Finish(digest);
+                download.sha256 = hash::toHex(digest, sizeof(digest));
+            }
+            if (!download.expected_sha256.empty() && download.sha256 != download.expected_sha256) { // never reaches the installer
+                download.corrupt = true;
+                download.result = CURLE_WRITE_ERROR;
+                removeFile(download.path);
+                ok = false;
+                return;
+            }
+            const Segment& first = state.segments[0];
+            curl_off_t size = first.length > 0 ? state.size : first.received; // a preallocated stream may have been promised more than it sent
+            std::error_code error;
+            if (download.sink == nullptr && (curl_off_t)std::filesystem::file_size(download.path, error) != size && !error)
+                std::filesystem::resize_file(download.path, size, error);
+            if (on_complete != nullptr)
+                on_complete(user_data, download);
+        };
+
+        auto dropDownload = [&](Download& download) {
+            for (size_t i = parts.size(); i-- > 0;)
+                if (parts[i]->download == &download)
+                    dropPart(multi, parts, i, closing);
+        };
+
+        // the outcome of a part only counts once the writer closed it, a write error may still be queued until then
+        auto reapParts = [&]() {
+            for (size_t i = 0; i < closing.size();) {
+                Part& part = *closing[i];
+                if (!part.closed.load(std::memory_order_acquire)) {
+                    i++;
+                    continue;
+                }
+                Download& download = *part.download;
+                DownloadState& state = *part.state;
+                if (part.write_failed) { // card full or gone, what the sidecar would claim isn't on disk
+                    download.result = CURLE_WRITE_ERROR;
+                    state.failed = true;
+                    state.restart = true;
+                }
+                else if (!part.finished) // dropped along with a failed sibling or a cancel, which set the result
+                    state.failed = true;
+                else if (part.result != CURLE_OK || !part.complete) {
+                    download.result = part.result != CURLE_OK ? part.result : CURLE_PARTIAL_FILE;
+                    state.failed = true;
+                    if (download.http_code >= 400) // 404, 416... nothing to resume
+                        state.restart = true;
+                }
+                else if (!state.failed)
+                    download.result = CURLE_OK;
+                closing.erase(closing.begin() + i);
+                if (state.failed) // segments still running are useless without this one
+                    dropDownload(download);
+                if (--state.parts_left == 0)
+                    finishDownload(download);
+            }
+        };
+
+        while (finished < downloads.size() && !cancelled) {
+            while (downloading < max_concurrent && next < downloads.size()) { // keep the link busy up to the cap
+                Download& download = downloads[next];
+                DownloadState& state = states[next++];
+                downloading++;
+                state.parts_left = start(multi, writer, download, state, parts);
+                if (state.failed) // segments that did start are useless without the others, it finishes once they are closed
+                    dropDownload(download);
+                if (state.parts_left == 0) { // everything was already on disk, or nothing could be started
+                    if (!state.failed)
+                        download.result = CURLE_OK;
+                    finishDownload(download);
+                }
+            }
+            if (parts.empty()) {
+                if (closing.empty())
+                    break;
+                writer.Sync(); // nothing is being received, the last files are only waiting for the card
+                reapParts();
+                continue;
+            }
+
+            int running = 0;
+            if (curl_multi_perform(multi, &running) != CURLM_OK) {
+                ok = false;
+                break;
+            }
+            int queued = 0;
+            while (CURLMsg* message = curl_multi_info_read(multi, &queued)) {
+                if (message->msg != CURLMSG_DONE)
+                    continue;
+                for (size_t i = 0; i < parts.size(); i++) {
+                    if (parts[i]->curl->request != message->easy_handle)
+                        continue;
+                    Part& part = *parts[i];
+                    part.finished = true;
+                    part.result = message->data.result;
+                    submitPart(part);
+                    part.complete = !part.ranged || part.segment->received == part.segment->length;
+                    recordTransfer(message->easy_handle, message->data.result);
+                    curl_easy_getinfo(message->easy_handle, CURLINFO_RESPONSE_CODE, &part.download->http_code);
+                    dropPart(multi, parts, i, closing);
+                    break;
+                }
+            }
+            reapParts();
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_sidecar_save >= std::chrono::milliseconds(SIDECAR_INTERVAL_MS)) { // a crash or power loss keeps at most this much progress
+                last_sidecar_save = now;
+                for (size_t i = 0; i < downloads.size(); i++)
+                    if (states[i].parts_left > 0 && !downloads[i].done && resumable(states[i]))
+                        saveSidecar(downloads[i], states[i]);
+            }
+
+            if (on_progress != nullptr) {
+                DownloadProgress progress = { 0, 0, finished, downloads.size() };
+                for (const Download& download : downloads) {
+                    progress.total += download.total;
+                    progress.now += download.now;
+                }
+                cancelled = !on_progress(user_data, progress);
+            }
+            if (running > 0 && !cancelled)
+                curl_multi_wait(multi, nullptr, 0, 100, nullptr);
+        }
+
+        while (!parts.empty()) { // only left over when cancelled or broken, closing the files flushes them
+            parts.back()->download->result = CURLE_ABORTED_BY_CALLBACK;
+            dropPart(multi, parts, parts.size() - 1, closing);
+        }
+        writer.Sync(); // nothing is being received anymore
+        reapParts(); // unfinished downloads keep their sidecar, or lose their file when it can't be resumed
+        for (size_t i = 0; i < next; i++) {
+            if (downloads[i].done)
+                continue;
+            if (resumable(states[i]))
+                saveSidecar(downloads[i], states[i]);
+            else
+                removeFile(downloads[i].path);
+        }
+        curl_multi_cleanup(multi);
+        {
+            std::lock_guard<std::mutex> guard(stats_lock);
+            write_stats = writer.Stats();
+        }
+        return ok && !cancelled && finished == downloads.size();
+    }
+
+    WriteStats getWriteStats() {
+        std::lock_guard<std::mutex> guard(stats_lock);
+        return write_stats;
+    }
+}
@@ -0,0 +1,413 @@
+#include "hash.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HASH_ARM_CRC32
+#endif
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+#include <arm_neon.h>
+#define HASH_ARM_SHA256
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HASH_X86
+#endif
+
+namespace hash {
+
+    namespace { // hash detail stuff
+        typedef void (*Sha256Kernel)(uint32_t state[8], const uint8_t* data, size_t blocks);
+        typedef uint32_t (*Crc32Kernel)(uint32_t crc, const uint8_t* data, size_t size);
+
+        const uint32_t SHA256_INITIAL[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+
+        alignas(16) const uint32_t SHA256_K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+        void sha256Portable(uint32_t state[8], const uint8_t* data, size_t blocks) {
+            for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+                uint32_t w[64];
+                for (int i = 0; i < 16; i++)
+                    w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 | (uint32_t)data[i * 4 + 2] << 8 | data[i * 4 + 3];
+                for (int i = 16; i < 64; i++) {
+                    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+                }
+                uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+                for (int i = 0; i < 64; i++) {
+                    uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+                    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                    h = g; g = f; f = e; e = d + t1;
+                    d = c; c = b; b = a; a = t1 + t2;
+                }
+                state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+                state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+            }
+        }
+
+        uint32_t crc_table[256];
+
+        void buildCrcTable() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++)
+                    crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+                crc_table[i] = crc;
+            }
+        }
+
+        uint32_t crc32Portable(uint32_t crc, const uint8_t* data, size_t size) {
+            crc = ~crc;
+            while (size--)
+                crc = crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+            return ~crc;
+        }
+
+#ifdef HASH_ARM_SHA256
+        void sha256Arm(uint32_t state[8], const uint8_t* data, size_t blocks) {
+            uint32x4_t abcd = vld1q_u32(&state[0]);
+            uint32x4_t efgh = vld1q_u32(&state[4]);
+            for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+                uint32x4_t abcd_saved = abcd;
+                uint32x4_t efgh_saved = efgh;
+                uint32x4_t msg[4];
+                for (int i = 0; i < 4; i++)
+                    msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+                for (int i = 0; i < 16; i++) { // four rounds per iteration, msg[i & 3] always holds the next four schedule words
+                    uint32x4_t wk = vaddq_u32(msg[i & 3], vld1q_u32(&SHA256_K[i * 4]));
+                    if (i < 12)
+                        msg[i & 3] = vsha256su1q_u32(vsha256su0q_u32(msg[i & 3], msg[(i + 1) & 3]), msg[(i + 2) & 3], msg[(i + 3) & 3]);
+                    uint32x4_t abcd_before = abcd;
+                    abcd = vsha256hq_u32(abcd, efgh, wk);
+                    efgh = vsha256h2q_u32(efgh, abcd_before, wk);
+                }
+                abcd = vaddq_u32(abcd, abcd_saved);
+                efgh = vaddq_u32(efgh, efgh_saved);
+            }
+            vst1q_u32(&state[0], abcd);
+            vst1q_u32(&state[4], efgh);
+        }
+#endif
+
+#ifdef HASH_ARM_CRC32
+        uint32_t crc32Arm(uint32_t crc, const uint8_t* data, size_t size) {
+            crc = ~crc;
+            while (size > 0 && ((uintptr_t)data & 7) != 0) {
+                crc = __crc32b(crc, *data++);
+                size--;
+            }
+            for (; size >= 8; size -= 8, data += 8) {
+                uint64_t word;
+                memcpy(&word, data, sizeof(word));
+                crc = __crc32d(crc, word);
+            }
+            while (size--)
+                crc = __crc32b(crc, *data++);
+            return ~crc;
+        }
+#endif
+
+#ifdef HASH_X86
+        /// Intel's SHA extensions keep the state as ABEF/CDGH instead of ABCD/EFGH
+        __attribute__((target("sha,sse4.1")))
+        void sha256ShaNi(uint32_t state[8], const uint8_t* data, size_t blocks) {
+            const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+            __m128i cdab = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+            __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+            __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+            __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+            for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+                __m128i abef_saved = abef;
+                __m128i cdgh_saved = cdgh;
+                __m128i msg[4];
+                for (int i = 0; i < 4; i++)
+                    msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i * 16)), byte_swap);
+                for (int i = 0; i < 16; i++) {
+                    __m128i wk = _mm_add_epi32(msg[i & 3], _mm_load_si128((const __m128i*)&SHA256_K[i * 4]));
+                    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+                    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0E));
+                    if (i < 12) {
+                        __m128i next = _mm_sha256msg1_epu32(msg[i & 3], msg[(i + 1) & 3]);
+                        next = _mm_add_epi32(next, _mm_alignr_epi8(msg[(i + 3) & 3], msg[(i + 2) & 3], 4));
+                        msg[i & 3] = _mm_sha256msg2_epu32(next, msg[(i + 3) & 3]);
+                    }
+                }
+                abef = _mm_add_epi32(abef, abef_saved);
+                cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+            }
+            __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+            __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+            _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(feba, dchg, 0xF0));
+            _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+        }
+
+        /// Folds 64 bytes at a time with carry-less multiplies ("Fast CRC Computation for Generic Polynomials Using
+        /// PCLMULQDQ", Intel 2009), the tail that doesn't fill 16 bytes goes through the table
+        __attribute__((target("pclmul,sse4.1")))
+        uint32_t crc32Pclmul(uint32_t crc, const uint8_t* data, size_t size) {
+            if (size < 64)
+                return crc32Portable(crc, data, size);
+            alignas(16) static const uint64_t k1k2[2] = { 0x0154442bd4, 0x01c6e41596 };
+            alignas(16) static const uint64_t k3k4[2] = { 0x01751997d0, 0x00ccaa009e };
+            alignas(16) static const uint64_t k5k0[2] = { 0x0163cd6124, 0x0000000000 };
+            alignas(16) static const uint64_t poly[2] = { 0x01db710641, 0x01f7011641 };
+            size_t tail = size & 15;
+            size -= tail;
+
+            __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + 0x00)), _mm_cvtsi32_si128(~crc));
+            __m128i x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+            __m128i x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+            __m128i x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+            __m128i k = _mm_load_si128((const __m128i*)k1k2);
+            data += 64;
+            size -= 64;
+            for (; size >= 64; size -= 64, data += 64) {
+                __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+                __m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+                __m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+                __m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+                x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x11), x5), _mm_loadu_si128((const __m128i*)(data + 0x00)));
+                x2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x2, k, 0x11), x6), _mm_loadu_si128((const __m128i*)(data + 0x10)));
+                x3 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x3, k, 0x11), x7), _mm_loadu_si128((const __m128i*)(data + 0x20)));
+                x4 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x4, k, 0x11), x8), _mm_loadu_si128((const __m128i*)(data + 0x30)));
+            }
+
+            // fold the four lanes into one, then whatever 16 byte blocks are left
+            k = _mm_load_si128((const __m128i*)k3k4);
+            __m128i lanes[3] = { x2, x3, x4 };
+            for (__m128i lane : lanes)
+                x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x11), lane), _mm_clmulepi64_si128(x1, k, 0x00));
+            for (; size >= 16; size -= 16, data += 16)
+                x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x11), _mm_loadu_si128((const __m128i*)data)), _mm_clmulepi64_si128(x1, k, 0x00));
+
+            // 128 -> 64 bits, then Barrett reduction to 32
+            __m128i low_mask = _mm_setr_epi32(~0, 0, ~0, 0);
+            x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k, 0x10));
+            k = _mm_loadl_epi64((const __m128i*)k5k0);
+            x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low_mask), k, 0x00), _mm_srli_si128(x1, 4));
+            k = _mm_load_si128((const __m128i*)poly);
+            __m128i x2b = _mm_clmulepi64_si128(_mm_and_si128(x1, low_mask), k, 0x10);
+            x2b = _mm_clmulepi64_si128(_mm_and_si128(x2b, low_mask), k, 0x00);
+            crc = ~(uint32_t)_mm_extract_epi32(_mm_xor_si128(x1, x2b), 1);
+            return crc32Portable(crc, data, tail);
+        }
+#endif
+
+        struct Dispatch {
+            Sha256Kernel sha256;
+            Crc32Kernel crc32;
+            const char* sha256_name;
+            const char* crc32_name;
+        };
+
+        Dispatch portable_dispatch = { sha256Portable, crc32Portable, "portable", "portable (table)" };
+
+        /// SHA-256("abc"), the one block example of FIPS 180-2
+        bool sha256Works(Sha256Kernel kernel) {
+            static const uint32_t expected[8] = {
+                0xba7816bf, 0x8f01cfea, 0x414140de, 0x5dae2223, 0xb00361a3, 0x96177a9c, 0xb410ff61, 0xf20015ad
+            };
+            uint8_t block[SHA256_BLOCK_SIZE] = { 'a', 'b', 'c', 0x80 };
+            block[SHA256_BLOCK_SIZE - 1] = 3 * 8; // message length in bits
+            uint32_t state[8];
+            memcpy(state, SHA256_INITIAL, sizeof(state));
+            kernel(state, block, 1);
+            return memcmp(state, expected, sizeof(state)) == 0;
+        }
+
+        /// CRC-32("123456789") is the check value of the catalogue. The kernels only take their fast path past a few
+        /// dozen bytes, so a longer run of the same digits is compared against the table as well
+        bool crc32Works(Crc32Kernel kernel) {
+            static const char check[] = "123456789";
+            if (kernel(0, (const uint8_t*)check, 9) != 0xCBF43926)
+                return false;
+            uint8_t digits[9 * 29]; // odd length, starts the aligned kernels on an unaligned tail
+            for (size_t i = 0; i < sizeof(digits); i++)
+                digits[i] = check[i % 9];
+            return kernel(0, digits + 1, sizeof(digits) - 1) == crc32Portable(0, digits + 1, sizeof(digits) - 1);
+        }
+
+        /// Picked once, the Switch always has the ARMv8 extensions the Makefile targets, x86 hosts are checked with cpuid.
+        /// An accelerated kernel that fails its known answer is swapped for the portable one
+        Dispatch detect() {
+            buildCrcTable();
+            Dispatch ret = portable_dispatch;
+#ifdef HASH_ARM_SHA256
+            ret.sha256 = sha256Arm;
+            ret.sha256_name = "ARMv8 sha256h";
+#endif
+#ifdef HASH_ARM_CRC32
+            ret.crc32 = crc32Arm;
+            ret.crc32_name = "ARMv8 crc32x";
+#endif
+#ifdef HASH_X86
+            unsigned int eax, ebx, ecx, edx;
+            bool sse41 = false;
+            if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+                sse41 = (ecx & bit_SSE4_1) != 0;
+                if (sse41 && (ecx & bit_PCLMUL) != 0) {
+                    ret.crc32 = crc32Pclmul;
+                    ret.crc32_name = "x86 PCLMULQDQ";
+                }
+            }
+            if (sse41 && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA) != 0) {
+                ret.sha256 = sha256ShaNi;
+                ret.sha256_name = "x86 SHA-NI";
+            }
+#endif
+            if (ret.sha256 != portable_dispatch.sha256 && !sha256Works(ret.sha256)) {
+                ret.sha256 = portable_dispatch.sha256;
+                ret.sha256_name = portable_dispatch.sha256_name;
+            }
+            if (ret.crc32 != portable_dispatch.crc32 && !crc32Works(ret.crc32)) {
+                ret.crc32 = portable_dispatch.crc32;
+                ret.crc32_name = portable_dispatch.crc32_name;
+            }
+            return ret;
+        }
+
+        Dispatch accelerated_dispatch = detect();
+        const Dispatch* dispatch = &accelerated_dispatch;
+    }
+
+    void Sha256::Reset() {
+        memcpy(m_State, SHA256_INITIAL, sizeof(m_State));
+        m_Length = 0;
+    }
+
+    void Sha256::Update(const void* data, size_t size) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        size_t buffered = m_Length % SHA256_BLOCK_SIZE;
+        m_Length += size;
+        if (buffered > 0) {
+            size_t needed = SHA256_BLOCK_SIZE - buffered;
+            if (size < needed) {
+                memcpy(m_Buffer + buffered, bytes, size);
+                return;
+            }
+            memcpy(m_Buffer + buffered, bytes, needed);
+            dispatch->sha256(m_State, m_Buffer, 1);
+            bytes += needed;
+            size -= needed;
+        }
+        if (size >= SHA256_BLOCK_SIZE) { // straight from the caller's buffer, no copy
+            dispatch->sha256(m_State, bytes, size / SHA256_BLOCK_SIZE);
+            bytes += size - size % SHA256_BLOCK_SIZE;
+            size %= SHA256_BLOCK_SIZE;
+        }
+        memcpy(m_Buffer, bytes, size);
+    }
+
+    void Sha256::Finish(uint8_t digest[SHA256_SIZE]) {
+        uint64_t bits = m_Length * 8;
+        uint8_t padding[SHA256_BLOCK_SIZE * 2] = { 0x80 };
+        size_t buffered = m_Length % SHA256_BLOCK_SIZE;
+        size_t padding_size = (buffered < 56 ? 56 : 120) - buffered;
+        Update(padding, padding_size);
+        uint8_t length[8];
+        for (int i = 0; i < 8; i++)
+            length[i] = (uint8_t)(bits >> (56 - i * 8));
+        Update(length, sizeof(length));
+        for (int i = 0; i < 8; i++)
+            for (int j = 0; j < 4; j++)
+                digest[i * 4 + j] = (uint8_t)(m_State[i] >> (24 - j * 8));
+    }
+
+    std::string Sha256::SaveState() const {
+        uint8_t words[sizeof(m_State) + sizeof(m_Length)];
+        for (int i = 0; i < 8; i++)
+            for (int j = 0; j < 4; j++)
+                words[i * 4 + j] = (uint8_t)(m_State[i] >> (24 - j * 8));
+        for (int i = 0; i < 8; i++)
+            words[32 + i] = (uint8_t)(m_Length >> (56 - i * 8));
+        return toHex(words, sizeof(words)) + toHex(m_Buffer, m_Length % SHA256_BLOCK_SIZE);
+    }
+
+    bool Sha256::LoadState(const std::string& state) {
+        static constexpr size_t FIXED_SIZE = sizeof(m_State) + sizeof(m_Length);
+        if (state.size() < FIXED_SIZE * 2 || state.size() % 2 != 0)
+            return false;
+        uint8_t bytes[FIXED_SIZE + SHA256_BLOCK_SIZE];
+        size_t count = state.size() / 2;
+        if (count > sizeof(bytes))
+            return false;
+        for (size_t i = 0; i < count; i++) {
+            char byte[3] = { state[i * 2], state[i * 2 + 1], 0 };
+            if (!isxdigit((unsigned char)byte[0]) || !isxdigit((unsigned char)byte[1]))
+                return false;
+            bytes[i] = (uint8_t)strtoul(byte, nullptr, 16);
+        }
+        uint64_t length = 0;
+        for (int i = 0; i < 8; i++)
+            length = length << 8 | bytes[32 + i];
+        if (count - FIXED_SIZE != length % SHA256_BLOCK_SIZE)
+            return false;
+        for (int i = 0; i < 8; i++)
+            m_State[i] = (uint32_t)bytes[i * 4] << 24 | (uint32_t)bytes[i * 4 + 1] << 16 | (uint32_t)bytes[i * 4 + 2] << 8 | bytes[i * 4 + 3];
+        m_Length = length;
+        memcpy(m_Buffer, bytes + FIXED_SIZE, count - FIXED_SIZE);
+        return true;
+    }
+
+    uint32_t crc32(uint32_t crc, const void* data, size_t size) {
+        return dispatch->crc32(crc, (const uint8_t*)data, size);
+    }
+
+    uint32_t crc32Combine(uint32_t first, uint32_t second, int64_t second_length) {
+        return ::crc32_combine(first, second, (z_off_t)second_length);
+    }
+
+    const char* sha256Implementation() { return dispatch->sha256_name; }
+    const char* crc32Implementation() { return dispatch->crc32_name; }
+
+    void forcePortable(bool portable) {
+        dispatch = portable ? &portable_dispatch : &accelerated_dispatch;
+    }
+
+    std::string toHex(const uint8_t* data, size_t size) {
+        static const char digits[] = "0123456789abcdef";
+        std::string ret(size * 2, '0');
+        for (size_t i = 0; i < size; i++) {
+            ret[i * 2] = digits[data[i] >> 4];
+            ret[i * 2 + 1] = digits[data[i] & 0xF];
+        }
+        return ret;
+    }
+
+    std::string findSha256(const std::string& text) {
+        size_t run = 0;
+        for (size_t i = 0; i <= text.size(); i++) {
+            if (i < text.size() && isxdigit((unsigned char)text[i])) {
+                run++;
+                continue;
+            }
+            if (run == SHA256_SIZE * 2) { // exactly 64, longer runs are something else (sha512...)
+                std::string ret = text.substr(i - run, run);
+                for (char& c : ret)
+                    c = tolower((unsigned char)c);
+                return ret;
+            }
+            run = 0;
+        }
+        return "";
+    }
+}
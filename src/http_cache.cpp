@@ -0,0 +1,96 @@
+#include "http_cache.hpp"
+#include "json.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+using json = nlohmann::json;
+
+namespace net {
+
+    namespace { // cache detail stuff
+        std::mutex cache_lock; // startup batch and the menu can hit the same entries
+        std::string cache_directory;
+
+        uint64_t fnv1a(uint64_t hash, const std::string& data) { // stable across builds, unlike std::hash
+            for (unsigned char c : data) {
+                hash ^= c;
+                hash *= 0x100000001B3ull;
+            }
+            return hash;
+        }
+
+        std::string bodyPath(const std::string& key) { return cache_directory + key + ".body"; }
+        std::string metaPath(const std::string& key) { return cache_directory + key + ".json"; }
+    }
+
+    void setCacheDirectory(const std::string& directory) {
+        std::lock_guard<std::mutex> guard(cache_lock);
+        cache_directory = directory;
+        if (!cache_directory.empty() && cache_directory.back() != '/')
+            cache_directory += '/';
+        std::error_code error;
+        if (!cache_directory.empty() && !std::filesystem::exists(cache_directory, error))
+            std::filesystem::create_directories(cache_directory, error);
+    }
+
+    std::string cacheKey(const std::string& url, const std::vector<std::string>& headers) {
+        uint64_t hash = fnv1a(0xCBF29CE484222325ull, url);
+        for (const std::string& header : headers)
+            hash = fnv1a(hash, "\n" + header);
+        char buffer[17];
+        snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)hash);
+        return buffer;
+    }
+
+    bool loadCachedResponse(const std::string& key, CachedResponse& response) {
+        std::lock_guard<std::mutex> guard(cache_lock);
+        if (cache_directory.empty())
+            return false;
+        std::ifstream meta_file(metaPath(key), std::ios_base::in);
+        std::ifstream body_file(bodyPath(key), std::ios_base::in | std::ios_base::binary);
+        if (!meta_file.is_open() || !body_file.is_open())
+            return false;
+        try {
+            json meta = json::parse(meta_file);
+            if (!meta.is_object())
+                return false;
+            response.url = meta.value("url", "");
+            response.etag = meta.value("etag", "");
+            response.last_modified = meta.value("last_modified", "");
+            response.next_page = meta.value("next_page", "");
+        }
+        catch (json::exception& e) { return false; } // not json, or a field of the wrong type
+        std::stringstream buffer;
+        buffer << body_file.rdbuf();
+        response.body = buffer.str();
+        return !response.etag.empty() || !response.last_modified.empty();
+    }
+
+    void storeCachedResponse(const std::string& key, const CachedResponse& response) {
+        std::lock_guard<std::mutex> guard(cache_lock);
+        if (cache_directory.empty())
+            return;
+        json meta = {
+            { "url", response.url },
+            { "etag", response.etag },
+            { "last_modified", response.last_modified },
+            { "next_page", response.next_page }
+        };
+        // the meta file goes away until the new body is fully written, a half written body is never served
+        std::error_code error;
+        std::filesystem::remove(metaPath(key), error);
+        std::ofstream body_file(bodyPath(key), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        if (!body_file.is_open())
+            return;
+        body_file.write(response.body.data(), response.body.size());
+        body_file.close();
+        std::ofstream meta_file(metaPath(key), std::ios_base::out | std::ios_base::trunc);
+        if (meta_file.is_open())
+            meta_file << meta.dump();
+    }
+}
@@ -0,0 +1,123 @@
+#include "install_index.hpp"
+#include "hash.hpp"
+#include "json.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+using json = nlohmann::json;
+
+namespace zip {
+
+    namespace { // install index detail stuff
+        static constexpr size_t HASH_CHUNK_SIZE = 1024 * 1024;
+
+        /// Size and mtime in one stat, false if the file isn't there
+        bool statFile(const std::string& path, uint64_t& size, int64_t& mtime) {
+            std::error_code error;
+            size = std::filesystem::file_size(path, error);
+            if (error)
+                return false;
+            mtime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+            return !error;
+        }
+
+        bool hashFile(const std::string& path, uint32_t& crc) {
+            FILE* file = fopen(path.c_str(), "rb");
+            if (file == nullptr)
+                return false;
+            std::unique_ptr<char[]> buffer(new char[HASH_CHUNK_SIZE]);
+            crc = 0;
+            size_t read;
+            while ((read = fread(buffer.get(), 1, HASH_CHUNK_SIZE, file)) > 0)
+                crc = hash::crc32(crc, buffer.get(), read);
+            bool ok = !ferror(file);
+            fclose(file);
+            return ok;
+        }
+    }
+
+    InstallIndex::InstallIndex(const std::string& path) : m_Path(path), m_Dirty(false) {
+        std::ifstream file(path, std::ios_base::in);
+        if (!file.is_open())
+            return;
+        json parsed;
+        try { parsed = json::parse(file); }
+        catch (json::parse_error& e) { return; }
+        if (!parsed.is_object() || !parsed["files"].is_object())
+            return;
+        for (auto& item : parsed["files"].items()) {
+            const json& entry = item.value();
+            if (!entry.is_array() || entry.size() != 3 || !entry[0].is_number_unsigned() || !entry[1].is_number_unsigned() || !entry[2].is_number_integer())
+                continue;
+            m_Files[item.key()] = { entry[0].get<uint32_t>(), entry[1].get<uint64_t>(), entry[2].get<int64_t>() };
+        }
+    }
+
+    bool InstallIndex::Unchanged(const std::string& path, uint32_t crc, uint64_t size) {
+        uint64_t on_disk;
+        int64_t mtime;
+        if (!statFile(path, on_disk, mtime) || on_disk != size)
+            return false;
+        {
+            std::lock_guard<std::mutex> guard(m_Lock);
+            auto found = m_Files.find(path);
+            if (found != m_Files.end() && found->second.size == size && found->second.mtime == mtime) // untouched since we wrote it
+                return found->second.crc == crc;
+        }
+        // not ours or modified since, same size is worth a read to avoid a write
+        uint32_t actual;
+        if (!hashFile(path, actual) || actual != crc)
+            return false;
+        std::lock_guard<std::mutex> guard(m_Lock);
+        m_Files[path] = { crc, size, mtime };
+        m_Dirty = true;
+        return true;
+    }
+
+    bool InstallIndex::Recorded(const std::string& path, uint32_t crc, uint64_t size) {
+        uint64_t on_disk;
+        int64_t mtime;
+        if (!statFile(path, on_disk, mtime) || on_disk != size)
+            return false;
+        std::lock_guard<std::mutex> guard(m_Lock);
+        auto found = m_Files.find(path);
+        return found != m_Files.end() && found->second.crc == crc && found->second.size == size && found->second.mtime == mtime;
+    }
+
+    void InstallIndex::Record(const std::string& path, uint32_t crc, uint64_t size) {
+        uint64_t on_disk;
+        int64_t mtime;
+        std::lock_guard<std::mutex> guard(m_Lock);
+        if (statFile(path, on_disk, mtime) && on_disk == size)
+            m_Files[path] = { crc, size, mtime };
+        else
+            m_Files.erase(path);
+        m_Dirty = true;
+    }
+
+    bool InstallIndex::Save() {
+        std::lock_guard<std::mutex> guard(m_Lock);
+        if (!m_Dirty)
+            return true;
+        json files = json::object();
+        for (const auto& file : m_Files)
+            files[file.first] = { file.second.crc, file.second.size, file.second.mtime };
+        std::string temporary = m_Path + ".tmp"; // a crash mid-write must not leave a truncated index behind
+        {
+            std::ofstream file(temporary, std::ios_base::out | std::ios_base::trunc);
+            if (!file.is_open())
+                return false;
+            file << json({ { "files", files } }).dump();
+            if (!file)
+                return false;
+        }
+        std::error_code error;
+        std::filesystem::remove(m_Path, error);
+        std::filesystem::rename(temporary, m_Path, error);
+        m_Dirty = error.value() != 0;
+        return !error;
+    }
+}
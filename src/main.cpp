@@ -1,8 +1,14 @@
+#include "benchmark.hpp"
 #include "console.h"
 #include "menu.hpp"
 #include "tree_node.hpp"
 #include "utils.hpp"
 
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
+
 static struct {
     gh::OauthToken token;
     bool isEndUser;
@@ -11,28 +17,144 @@ static struct {
 } user;
 //json installed_json;
 
+static struct {
+    std::mutex lock;
+    std::vector<gh::Channel> channels;
+    bool ready;
+} refresh; // filled in by the network thread, applied to the menu by the main loop
+
+
+/// Turns releases into downloadable children of a release menu
+void AddReleases(TreeNode* menu, const std::string& REPO, const std::vector<gh::Release>& releases) {
+    for (size_t i = 0; i < releases.size(); i++) {
+        //bool is_installed = installed_json["Installed"].contains(releases[i].name);
+        const GhDownload dl = {user.token, REPO, releases[i].tag/*, is_installed*/};
+        makeDownloadable(menu->SpawnChild(), releases[i].name, releases[i].body, dl);
+    }
+}
 
-void CreateReleasesMenu(TreeNode* start, std::vector<std::string>* entries, const std::string releases_name, const std::string REPO) {
+/// Returns the release menu of the channel, nullptr if it has no releases
+TreeNode* CreateReleasesMenu(TreeNode* start, std::vector<std::string>* entries, const std::string releases_name, const gh::Channel& channel) {
     entries->push_back("Install " + releases_name);
-    std::vector<gh::Release> releases = gh::getReleases(user.token, REPO);
-    if (releases.size() == 0)
+    const std::string& REPO = channel.repository;
+    const std::vector<gh::Release>& releases = channel.releases;
+    if (releases.size() == 0) {
         makeEmpty(start->SpawnChild(), releases_name, "No current release builds are available.");
-    else {
-        std::vector<std::string> names;
-        names.resize(releases.size());
+        return nullptr;
+    }
+    std::vector<std::string> names;
+    names.resize(releases.size());
 
-        for (size_t i = 0; i < releases.size(); i++)
-            names[i] = releases[i].name;
-        makeMenu(start->SpawnChild(), releases_name + " Releases:", names);
+    for (size_t i = 0; i < releases.size(); i++)
+        names[i] = releases[i].name;
+    TreeNode* menu = start->SpawnChild();
+    makeMenu(menu, releases_name + " Releases:", names);
+    AddReleases(menu, REPO, releases);
+    return menu;
+}
+
+/// Older releases are only requested once the selection gets this close to the end of a release menu
+static constexpr size_t PAGE_PREFETCH_DISTANCE = 5;
+/// A page that failed to load is asked for again after this long, not on every frame, the delay doubles with every attempt
+static constexpr std::chrono::seconds PAGE_RETRY_DELAY(5);
+/// Failed loads of the same page after which paging ends for the session
+static constexpr size_t PAGE_RETRY_LIMIT = 4;
 
-        for (size_t i = 0; i < releases.size(); i++) {
-            //bool is_installed = installed_json["Installed"].contains(releases[i].name);
-            const GhDownload dl = {user.token, REPO, releases[i].tag/*, is_installed*/};
-            makeDownloadable(start->GetChild(start->GetChildCount()-1)->SpawnChild(), releases[i].name, releases[i].body, dl);
+static struct ReleasePager {
+    TreeNode* menu;         // release menu of the channel, nullptr when there is none
+    std::string repository;
+    std::string next_page;  // url of the releases that are not in the menu yet
+    std::string requested;  // url the running load was started for
+    std::future<gh::ReleasePage> loading;
+    std::chrono::steady_clock::time_point retry_at; // no load is started before this
+    size_t failures;        // failed loads of next_page
+} pagers[3];
+
+/// Appends the pages that finished loading and starts loading the next page of the viewed menu when needed
+void UpdatePagers(TreeNode* current) {
+    for (ReleasePager& pager : pagers) {
+        if (pager.loading.valid() && pager.loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            gh::ReleasePage page = pager.loading.get();
+            if (pager.requested != pager.next_page) // the menu was rebuilt in the meantime
+                continue;
+            if (!page.fetched) { // a transient error keeps next_page, one that won't go away (4xx) ends paging
+                if (!page.retryable || ++pager.failures >= PAGE_RETRY_LIMIT)
+                    pager.next_page.clear();
+                pager.retry_at = std::chrono::steady_clock::now() + PAGE_RETRY_DELAY * (1 << pager.failures);
+            }
+            else if (pager.menu != nullptr) {
+                for (const gh::Release& release : page.releases)
+                    menuAddEntry(pager.menu, release.name);
+                AddReleases(pager.menu, pager.repository, page.releases);
+                pager.next_page = page.next_page;
+                pager.failures = 0;
+            }
+        }
+        if (pager.menu != nullptr && pager.menu == current && !pager.next_page.empty() && !pager.loading.valid()
+            && std::chrono::steady_clock::now() >= pager.retry_at && menuGetSelected(current) + PAGE_PREFETCH_DISTANCE >= menuGetEntryCount(current)) {
+            pager.requested = pager.next_page;
+            pager.loading = std::async(std::launch::async, gh::getReleasePage, user.token, pager.requested);
         }
     }
 }
 
+/// Rebuilds the main menu in place from the given channel list
+/// pending: the network has not answered yet
+void BuildMainMenu(TreeNode* start, const std::vector<gh::Channel>& channels, bool pending) {
+    while (start->GetChildCount() > 0)
+        start->RemoveChild(start->GetChild(0));
+    static const char* names[3] = { "HDR", "HDR-Beta", "HDR-Dev" };
+    bool* access[3] = { &user.isEndUser, &user.isBetaTester, &user.isDeveloper };
+    std::vector<std::string> entries;
+    for (size_t i = 0; i < channels.size() && i < 3; i++) {
+        *access[i] = channels[i].has_access;
+        pagers[i].menu = nullptr;
+        pagers[i].repository = channels[i].repository;
+        pagers[i].next_page = channels[i].next_page;
+        pagers[i].failures = 0;
+        if (channels[i].has_access)
+            pagers[i].menu = CreateReleasesMenu(start, &entries, names[i], channels[i]);
+    }
+    if (user.isDeveloper) { // on-device measurements of the download and install paths
+        std::vector<bench::Benchmark> benchmarks = bench::getBenchmarks();
+        std::vector<std::string> names;
+        for (const bench::Benchmark& benchmark : benchmarks)
+            names.push_back(benchmark.name);
+        entries.push_back("Benchmarks");
+        TreeNode* menu = start->SpawnChild();
+        makeMenu(menu, "Benchmarks:", names);
+        for (const bench::Benchmark& benchmark : benchmarks)
+            makeAction(menu->SpawnChild(), benchmark.name, benchmark.description, benchmark.run);
+    }
+    if (entries.empty()) { // an empty menu can't be navigated
+        entries.push_back(pending ? "Fetching releases..." : "No releases available");
+        makeEmpty(start->SpawnChild(), entries[0], pending ? "Release lists are being downloaded, this menu will update once they arrive." : "Check your internet connection and your oauth token.");
+    }
+    if (checkType(start) == NodeType::MENU)
+        menuSetEntries(start, entries);
+    else
+        makeMenu(start, "Main Menu", entries);
+}
+
+/// Fetches every channel, keeping the snapshot data of the channels the network gave no answer for
+void RefreshChannels(std::vector<gh::Channel> snapshot) {
+    std::vector<gh::Channel> channels = gh::getChannels(user.token, { RELEASE_REPO, BETA_REPO, DEV_REPO });
+    bool any_fetched = false;
+    for (size_t i = 0; i < channels.size(); i++) {
+        if (channels[i].fetched) {
+            any_fetched = true;
+            continue;
+        }
+        for (const gh::Channel& old : snapshot)
+            if (old.repository == channels[i].repository)
+                channels[i] = old;
+    }
+    if (any_fetched)
+        gh::saveChannelSnapshot(user.token, channels);
+    std::lock_guard<std::mutex> guard(refresh.lock);
+    refresh.channels = channels;
+    refresh.ready = true;
+}
 
 const std::string console_status = "\n" RED "X" RESET " to launch smash" MAGENTA "\t\t\t\tHDR Installer Ver. " + std::string(APP_VERSION) + WHITE "\t\t\t\t\t" RED "+" RESET " to exit" RESET;
 
@@ -47,8 +169,10 @@ int main(int argc, char** argv) {
     console_set_status(console_status.c_str());
     socketInitializeDefault();
     curl_global_init(CURL_GLOBAL_DEFAULT);
+    net::init();
 
     prep();
+    net::setCacheDirectory(std::string(APP_PATH) + "cache/");
     /*
     if (installed_json == NULL) {
         std::cout << RED "\nError parsing previously-installed mods." RESET << "\n\nIf you don't know what this error is, \ntry deleting the file at " << INSTALLED_MODS << "\n\nExiting...\n";
@@ -59,24 +183,23 @@ int main(int argc, char** argv) {
     TreeNode start;
     NodeViewer viewer(&start);
     user.token = loadOauthToken();
-    user.isEndUser = gh::isEndUser(user.token);
-    user.isBetaTester = gh::isBetaTester(user.token);
-    user.isDeveloper = gh::isDeveloper(user.token);
-    std::vector<std::string> entries;
-    if (user.isEndUser) {
-        CreateReleasesMenu(&start, &entries, "HDR", RELEASE_REPO);
-    }
-    if (user.isBetaTester) {
-        CreateReleasesMenu(&start, &entries, "HDR-Beta", BETA_REPO);
-    }
-    if (user.isDeveloper) {
-        CreateReleasesMenu(&start, &entries, "HDR-Dev", DEV_REPO);
-    }
-    makeMenu(&start, "Main Menu", entries);
+    gh::setBackend(gh::Backend::GRAPHQL); // one round trip for every channel, falls back to REST without a token
+    std::vector<gh::Channel> snapshot;
+    gh::loadChannelSnapshot(user.token, snapshot);
+    BuildMainMenu(&start, snapshot, true); // usable right away, the network result patches it later
+    refresh.ready = false;
+    std::thread refresher(RefreshChannels, snapshot);
     appletSetCpuBoostMode(ApmCpuBoostMode_Normal);
     while (appletMainLoop()) {
         consoleClear();
         hidScanInput();
+        if (viewer.GetCurrent() == &start) { // only patch while nothing below the main menu is being viewed
+            std::lock_guard<std::mutex> guard(refresh.lock);
+            if (refresh.ready) {
+                BuildMainMenu(&start, refresh.channels, false);
+                refresh.ready = false;
+            }
+        }
         TreeNode* current = viewer.GetCurrent();
         u64 kDown = hidKeysDown(CONTROLLER_P1_AUTO);
         if (kDown & KEY_B)
@@ -99,14 +222,21 @@ int main(int argc, char** argv) {
             consoleUpdate(NULL);
             appletRequestLaunchApplication(0x01006A800016E000, NULL);
         }
+        UpdatePagers(viewer.GetCurrent());
         if (kDown & KEY_PLUS) break;
         viewer.Focus();
-        if (checkType(viewer.GetCurrent()) == NodeType::DOWNLOADABLE)
+        NodeType focused = checkType(viewer.GetCurrent());
+        if (focused == NodeType::DOWNLOADABLE || focused == NodeType::ACTION) // both run once and wait for B themselves
             viewer.ShiftFocus(-1);
         consoleUpdate(NULL);
     }
+    refresher.join();
+    for (ReleasePager& pager : pagers) // a page still loading uses the token and the curl handles torn down below
+        if (pager.loading.valid())
+            pager.loading.wait();
     destroyOauthToken(user.token);
     console_exit();
+    net::cleanup();
     curl_global_cleanup();
     socketExit();
     return 0;
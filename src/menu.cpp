@@ -14,6 +14,9 @@ NodeType checkType(TreeNode* node) {
             case EMPTY_MAGIC:
                 ret = NodeType::EMPTY;
                 break;
+            case ACTION_MAGIC:
+                ret = NodeType::ACTION;
+                break;
             default:
                 ret = NodeType::UNKNOWN;
                 break;
@@ -54,6 +57,27 @@ void _destroyEmpty(void* empty) {
     delete (Empty*)empty;
 }
 
+struct Action {
+    uint32_t magic;
+    std::string title;
+    std::string description;
+    void (*action)();
+};
+
+void _destroyAction(void* action) {
+    delete (Action*)action;
+}
+
+void waitForB() {
+    std::cout << WHITE "\n\nPress B to exit.\n" RESET;
+    consoleUpdate(NULL);
+    u64 k;
+    do {
+        hidScanInput();
+        k = hidKeysDown(CONTROLLER_P1_AUTO);
+    } while (!(k & KEY_B));
+}
+
 void menuFocus(TreeNode* node) {
     Menu& menu = *(Menu*)node->GetUserData();
     /*
@@ -106,6 +130,18 @@ void downloadableFocus(TreeNode* node) {
         case gh::DownloadResult::SUCCESS: {
             //downloadable.download.is_downloaded = true;
             std::cout << GREEN "\n\nSuccessfully installed: " RESET << downloadable.title << "\n\nTime elapsed: " << time(NULL) - seconds << " seconds\n";
+            net::PoolStats stats = net::getStats();
+            std::cout << "Reused connections: " << stats.handshakes_avoided << "/" << stats.requests << " requests (handshakes avoided)\n";
+            std::cout << "API traffic: " << stats.api_wire_bytes / 1024 << " KiB on the wire for " << stats.api_decoded_bytes / 1024 << " KiB of json\n";
+            net::WriteStats writes = net::getWriteStats();
+            std::cout << "SD writes: " << writes.bytes / 1024 << " KiB in " << writes.write_ms << " ms, queue peaked at " << writes.max_queue_depth << "/" << writes.queue_capacity << "\n";
+            std::cout << "Waiting on the card: " << writes.stall_ms << " ms, waiting on the network: " << writes.idle_ms << " ms\n";
+            gh::InstallStats installed = gh::getInstallStats();
+            std::cout << "Files: " << installed.written << " written, " << installed.skipped << " already up to date\n";
+            if (!installed.patched_from.empty())
+                std::cout << "Patched from " << installed.patched_from << " instead of downloading the full release\n";
+            if (installed.ranged_archive_bytes > 0)
+                std::cout << "Fetched only the changed files: " << installed.ranged_bytes / 1024 << " KiB instead of " << installed.ranged_archive_bytes / 1024 << " KiB\n";
             /*
             std::vector<std::pair<std::string, bool>> files;
             for (const auto& dirEntry : std::filesystem::recursive_directory_iterator(TMP_EXTRACTED)) {
@@ -129,24 +165,30 @@ void downloadableFocus(TreeNode* node) {
             std::cout << RED "Does not exist" RESET;
             break;
         case gh::DownloadResult::DOWNLOAD_FAILED:
-            std::cout << RED "Download failed" RESET;
+            std::cout << RED "Download failed" RESET "\nInstall again to resume it";
             break;
         case gh::DownloadResult::ACCESS_DENIED:
             std::cout << RED "Access denied" RESET;
             break;
+        case gh::DownloadResult::VERIFICATION_FAILED:
+            std::cout << RED "Checksum mismatch" RESET "\nThe download was corrupted and has been deleted, nothing was installed from it";
+            break;
+        case gh::DownloadResult::EXTRACTION_FAILED:
+            std::cout << RED "Extraction failed" RESET "\nThe archive was broken or the card is full, nothing was installed from it\n"
+                      << gh::getInstallStats().error;
+            break;
+        case gh::DownloadResult::NOT_ENOUGH_SPACE: {
+            gh::InstallEstimate estimate = gh::getInstallEstimate();
+            std::cout << RED "Not enough space" RESET "\nThe install needs " << estimate.write_bytes / (1024 * 1024) << " MiB on the SD card, "
+                      << estimate.free_bytes / (1024 * 1024) << " MiB are free";
+            break;
+        }
         default:
             std::cout << RED "Unknown result." RESET;
             break;
     }
 
-    std::cout << WHITE "\n\nPress B to exit.\n" RESET;
-    consoleUpdate(NULL);
-    u64 k;
-    do {
-        hidScanInput();
-        k = hidKeysDown(CONTROLLER_P1_AUTO);
-    } while (!(k & KEY_B));
-
+    waitForB();
 }
 
 void emptyFocus(TreeNode* node) {
@@ -155,6 +197,14 @@ void emptyFocus(TreeNode* node) {
     std::cout << empty.message << std::endl;
 }
 
+void actionFocus(TreeNode* node) {
+    Action& action = *(Action*)node->GetUserData();
+    std::cout << GREEN "\n\n" << action.title << "\n\n" RESET << action.description << "\n\n";
+    consoleUpdate(NULL);
+    action.action();
+    waitForB();
+}
+
 void makeMenu(TreeNode* node, const std::string& title, const std::vector<std::string>& entries) {
     Menu* menu = new Menu;
     menu->magic = MENU_MAGIC;
@@ -187,6 +237,29 @@ void makeEmpty(TreeNode* node, const std::string& title, const std::string& mess
     node->SetDestroyUserData(_destroyEmpty);
 }
 
+void makeAction(TreeNode* node, const std::string& title, const std::string& description, void (*action)()) {
+    Action* act = new Action;
+    act->magic = ACTION_MAGIC;
+    act->title = title;
+    act->description = description;
+    act->action = action;
+    node->SetUserData(act);
+    node->SetOnFocus(actionFocus);
+    node->SetDestroyUserData(_destroyAction);
+}
+
+void menuSetEntries(TreeNode* node, const std::vector<std::string>& entries) {
+    Menu* menu = (Menu*)node->GetUserData();
+    menu->entries = entries;
+    if (menu->selected >= menu->entries.size())
+        menu->selected = 0;
+}
+
+void menuAddEntry(TreeNode* node, const std::string& entry) {
+    Menu* menu = (Menu*)node->GetUserData();
+    menu->entries.push_back(entry);
+}
+
 void menuSelect(TreeNode* node, size_t selected) {
     Menu* menu = (Menu*)node->GetUserData();
     menu->selected = (selected % menu->entries.size());
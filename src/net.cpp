@@ -0,0 +1,290 @@
+#include "net.hpp"
+#include "http_cache.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+namespace net {
+
+    namespace { // pool detail stuff
+        CURLSH* share = nullptr;
+        std::mutex share_locks[CURL_LOCK_DATA_LAST]; // one lock per kind of shared data, the share callbacks can be called from any transfer
+
+        std::mutex pool_lock;
+        std::vector<PooledHandle*> idle_handles;
+        PoolStats stats = { 0, 0, 0, 0, 0 };
+
+        void shareLock(CURL* handle, curl_lock_data data, curl_lock_access access, void* user_data) {
+            share_locks[data].lock();
+        }
+
+        void shareUnlock(CURL* handle, curl_lock_data data, void* user_data) {
+            share_locks[data].unlock();
+        }
+
+        void attachShare(CURL* handle) {
+            if (share != nullptr)
+                curl_easy_setopt(handle, CURLOPT_SHARE, share);
+        }
+
+        /// Everything a transfer needs besides its handle, handed to the curl callbacks
+        struct Transfer {
+            Request* request;
+            ResponseBuffer* buffer;
+            CachedResponse cached;
+            long status; // of the response whose headers are coming in, redirects included
+        };
+
+        /// Link: <https://...&page=2>; rel="next", <https://...&page=5>; rel="last"
+        std::string parseNextLink(const std::string& value) {
+            size_t start = 0;
+            while (start < value.size()) {
+                size_t end = value.find(',', start);
+                if (end == std::string::npos)
+                    end = value.size();
+                std::string link = value.substr(start, end - start);
+                size_t open = link.find('<');
+                size_t close = link.find('>');
+                if (open != std::string::npos && close != std::string::npos && close > open && link.find("rel=\"next\"", close) != std::string::npos)
+                    return link.substr(open + 1, close - open - 1);
+                start = end + 1;
+            }
+            return "";
+        }
+
+        /// Picks the cache validators and the pagination link out of the response headers
+        size_t headerCallback(char* header, size_t size, size_t byte_count, void* user_data) {
+            Transfer& transfer = *(Transfer*)user_data;
+            Request& request = *transfer.request;
+            size_t length = size * byte_count;
+            std::string line(header, length);
+            if (line.rfind("HTTP/", 0) == 0) {
+                size_t space = line.find(' ');
+                transfer.status = space != std::string::npos ? strtol(line.c_str() + space + 1, nullptr, 10) : 0;
+                return length;
+            }
+            if (line == "\r\n" || line == "\n") // end of the headers, a ranged request that got a 200 would download the whole asset
+                return !request.range.empty() && transfer.status == 200 ? 0 : length;
+            size_t colon = line.find(':');
+            if (colon == std::string::npos)
+                return length;
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            size_t value_start = line.find_first_not_of(" \t", colon + 1);
+            size_t value_end = line.find_last_not_of(" \t\r\n");
+            std::string value = (value_start == std::string::npos || value_end < value_start) ? "" : line.substr(value_start, value_end - value_start + 1);
+            if (name == "etag")
+                request.etag = value;
+            else if (name == "last-modified")
+                request.last_modified = value;
+            else if (name == "link")
+                request.next_page = parseNextLink(value);
+            else if (name == "content-range")
+                request.content_range = value;
+            else if (name == "content-type")
+                request.content_type = value;
+            else if (name == "content-length")
+                transfer.buffer->Reserve(strtoull(value.c_str(), nullptr, 10));
+            return length;
+        }
+
+        /// Resets the results and fills the transfer with everything the request asks for
+        void prepare(Transfer& transfer, CURL_builder& curl) {
+            Request& request = *transfer.request;
+            CachedResponse& cached = transfer.cached;
+            transfer.buffer = &curl.pooled->buffer;
+            transfer.buffer->Clear();
+            request.result = CURLE_FAILED_INIT;
+            request.http_code = 0;
+            request.body.clear();
+            request.etag.clear();
+            request.last_modified.clear();
+            request.next_page.clear();
+            request.content_range.clear();
+            request.content_type.clear();
+            request.from_cache = false;
+            transfer.status = 0;
+
+            std::vector<std::string> headers = request.headers;
+            if (!request.post_body.empty()) {
+                request.cached = false;
+                curl.SetOPT(CURLOPT_POSTFIELDSIZE, (long)request.post_body.size())
+                    .SetOPT(CURLOPT_COPYPOSTFIELDS, request.post_body.c_str());
+            }
+            if (request.follow_redirects)
+                curl.SetOPT(CURLOPT_FOLLOWLOCATION, 1L);
+            if (request.cached && loadCachedResponse(cacheKey(request.url, request.headers), cached)) {
+                if (!cached.etag.empty())
+                    headers.push_back("If-None-Match: " + cached.etag);
+                if (!cached.last_modified.empty())
+                    headers.push_back("If-Modified-Since: " + cached.last_modified);
+            }
+            curl.SetHeaders(headers)
+                .SetURL(request.url)
+                .SetOPT(CURLOPT_WRITEDATA, transfer.buffer)
+                .SetOPT(CURLOPT_WRITEFUNCTION, ResponseBuffer::WriteCallback)
+                .SetOPT(CURLOPT_HEADERDATA, &transfer)
+                .SetOPT(CURLOPT_HEADERFUNCTION, headerCallback)
+                .SetOPT(CURLOPT_USERAGENT, "HDR-User")
+                .SetOPT(CURLOPT_ACCEPT_ENCODING, "") // every encoding the linked libcurl can decode (gzip, deflate, br, zstd), decoded as it streams in
+                .SetOPT(CURLOPT_CONNECTTIMEOUT, 10L) // offline consoles should fall back to cached data quickly
+                .SetOPT(CURLOPT_LOW_SPEED_LIMIT, STALL_SPEED)
+                .SetOPT(CURLOPT_LOW_SPEED_TIME, STALL_SECONDS);
+            if (!request.range.empty())
+                curl.SetOPT(CURLOPT_RANGE, request.range.c_str())
+                    .SetOPT(CURLOPT_ACCEPT_ENCODING, (char*)nullptr); // ranges of an encoded body aren't ranges of the file
+        }
+
+        /// Serves 304s from disk and stores fresh responses that carry a validator
+        void finish(Transfer& transfer, CURL* handle, CURLcode result) {
+            Request& request = *transfer.request;
+            CachedResponse& cached = transfer.cached;
+            request.body.assign(transfer.buffer->Data(), transfer.buffer->Size()); // one exact allocation, the buffer keeps its capacity for the next request
+            request.result = result;
+            curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &request.http_code);
+            recordTransfer(handle, result);
+            curl_off_t wire_bytes = 0; // counted before content decoding
+            curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &wire_bytes);
+            {
+                std::lock_guard<std::mutex> guard(pool_lock);
+                stats.api_wire_bytes += wire_bytes;
+                stats.api_decoded_bytes += transfer.buffer->Size();
+            }
+            if (!request.cached || result != CURLE_OK)
+                return;
+            if (request.http_code == 304 && !cached.url.empty()) {
+                request.body = std::move(cached.body);
+                request.next_page = cached.next_page; // a 304 doesn't have to repeat the Link header
+                request.http_code = 200;
+                request.from_cache = true;
+            }
+            else if (request.http_code == 200 && (!request.etag.empty() || !request.last_modified.empty()))
+                storeCachedResponse(cacheKey(request.url, request.headers), { request.url, request.etag, request.last_modified, request.next_page, request.body });
+        }
+    }
+
+    void init() {
+        if (share != nullptr)
+            return;
+        share = curl_share_init();
+        if (share == nullptr)
+            return;
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, shareLock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, shareUnlock);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900 // connection sharing landed in 7.57.0
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    }
+
+    void cleanup() {
+        std::lock_guard<std::mutex> guard(pool_lock);
+        for (PooledHandle* pooled : idle_handles) {
+            curl_easy_cleanup(pooled->handle);
+            delete pooled;
+        }
+        idle_handles.clear();
+        if (share != nullptr)
+            curl_share_cleanup(share);
+        share = nullptr;
+    }
+
+    PooledHandle* acquireHandle() {
+        {
+            std::lock_guard<std::mutex> guard(pool_lock);
+            if (!idle_handles.empty()) {
+                PooledHandle* pooled = idle_handles.back();
+                idle_handles.pop_back();
+                return pooled;
+            }
+        }
+        CURL* handle = curl_easy_init();
+        if (handle == nullptr)
+            return nullptr;
+        attachShare(handle);
+        return new PooledHandle{ handle, {} };
+    }
+
+    void releaseHandle(PooledHandle* pooled) {
+        if (pooled == nullptr)
+            return;
+        curl_easy_reset(pooled->handle); // drops every option (headers, callbacks...) but keeps the caches
+        attachShare(pooled->handle);
+        std::lock_guard<std::mutex> guard(pool_lock);
+        idle_handles.push_back(pooled);
+    }
+
+    void recordTransfer(CURL* handle, CURLcode result) {
+        long new_connections = 0;
+        curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &new_connections);
+        std::lock_guard<std::mutex> guard(pool_lock);
+        stats.requests++;
+        if (new_connections > 0)
+            stats.connections_opened += new_connections;
+        else if (result == CURLE_OK) // nothing new had to be opened, so the whole DNS/TCP/TLS setup was skipped
+            stats.handshakes_avoided++;
+    }
+
+    PoolStats getStats() {
+        std::lock_guard<std::mutex> guard(pool_lock);
+        return stats;
+    }
+
+    bool parseContentRange(const std::string& value, uint64_t& first, uint64_t& last, uint64_t& total) {
+        return sscanf(value.c_str(), "bytes %" SCNu64 "-%" SCNu64 "/%" SCNu64, &first, &last, &total) == 3 && first <= last && last < total;
+    }
+
+    void perform(Request& request) {
+        CURL_builder curl;
+        if (!curl) {
+            request.result = CURLE_FAILED_INIT;
+            return;
+        }
+        Transfer transfer = { &request, nullptr, {}, 0 };
+        prepare(transfer, curl);
+        finish(transfer, curl.request, curl_easy_perform(curl.request));
+    }
+
+    void performBatch(std::vector<Request>& requests) {
+        CURLM* multi = curl_multi_init();
+        if (multi == nullptr)
+            return;
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX); // a single HTTP/2 connection can carry the whole batch
+
+        std::vector<CURL_builder> curls(requests.size());
+        std::vector<Transfer> transfers(requests.size());
+        for (size_t i = 0; i < requests.size(); i++) {
+            if (!curls[i])
+                continue;
+            transfers[i].request = &requests[i];
+            prepare(transfers[i], curls[i]);
+            curls[i].SetOPT(CURLOPT_PRIVATE, (void*)&transfers[i]);
+            curl_multi_add_handle(multi, curls[i].request);
+        }
+
+        int running = 0;
+        do {
+            if (curl_multi_perform(multi, &running) != CURLM_OK)
+                break;
+            int queued = 0;
+            while (CURLMsg* message = curl_multi_info_read(multi, &queued)) {
+                if (message->msg != CURLMSG_DONE)
+                    continue;
+                Transfer* transfer = nullptr;
+                curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char**)&transfer);
+                finish(*transfer, message->easy_handle, message->data.result);
+            }
+            if (running > 0)
+                curl_multi_wait(multi, nullptr, 0, 100, nullptr);
+        } while (running > 0);
+
+        for (CURL_builder& curl : curls)
+            if (curl)
+                curl_multi_remove_handle(multi, curl.request);
+        curl_multi_cleanup(multi);
+    }
+}
@@ -0,0 +1,232 @@
+#include "patch.hpp"
+#include "hash.hpp"
+#include "zip_stream.hpp"
+
+#include <minizip/unzip.h>
+#define ZSTD_STATIC_LINKING_ONLY // ZSTD_getFrameHeader, to insist on a content checksum
+#include <zstd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+namespace patch {
+
+    namespace { // patch detail stuff
+        static constexpr size_t MAX_NAME_LENGTH = 1024;
+
+        struct Output {
+            FILE* file;
+            uint32_t crc;
+            uint64_t size;
+        };
+
+        struct Pending {
+            std::string pending;
+            std::string path;
+            uint32_t crc;
+            uint64_t size;
+        };
+
+        bool write(Output& output, const char* data, size_t size) {
+            output.crc = hash::crc32(output.crc, data, size);
+            output.size += size;
+            return fwrite(data, 1, size, output.file) == size;
+        }
+
+        bool endsWith(const std::string& text, const std::string& suffix) {
+            return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+        }
+
+        /// A missing file reads as empty, the delta then has to stand on its own
+        bool readFile(const std::string& path, std::string& data, std::string& message) {
+            data.clear();
+            std::error_code error;
+            if (!std::filesystem::exists(path, error))
+                return true;
+            uint64_t size = std::filesystem::file_size(path, error);
+            if (error) {
+                message = "couldn't read the installed file";
+                return false;
+            }
+            if (size > MAX_REFERENCE_SIZE) {
+                message = "the installed file is too large to patch in memory";
+                return false;
+            }
+            std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+            if (!file.is_open()) {
+                message = "couldn't read the installed file";
+                return false;
+            }
+            data.reserve(size);
+            data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            if (file.bad())
+                message = "couldn't read the installed file";
+            return !file.bad();
+        }
+
+        bool copyEntry(unzFile archive, Output& output, std::string& error) {
+            std::unique_ptr<char[]> buffer(new char[zip::OUTPUT_CHUNK_SIZE]);
+            int read;
+            while ((read = unzReadCurrentFile(archive, buffer.get(), zip::OUTPUT_CHUNK_SIZE)) > 0)
+                if (!write(output, buffer.get(), read)) {
+                    error = "is the card full?";
+                    return false;
+                }
+            if (read < 0)
+                error = "the patch is corrupt";
+            return read == 0;
+        }
+
+        /// Decompresses the delta with the installed file as the prefix it was made against
+        bool applyDelta(unzFile archive, const std::string& path, Output& output, std::string& error) {
+            std::string reference;
+            if (!readFile(path, reference, error))
+                return false;
+            std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+            if (!context) {
+                error = "out of memory";
+                return false;
+            }
+            ZSTD_DCtx_setParameter(context.get(), ZSTD_d_windowLogMax, WINDOW_LOG_MAX);
+            if (!reference.empty())
+                ZSTD_DCtx_refPrefix(context.get(), reference.data(), reference.size());
+
+            size_t in_size = ZSTD_DStreamInSize();
+            size_t out_size = ZSTD_DStreamOutSize();
+            std::unique_ptr<char[]> in(new char[in_size]);
+            std::unique_ptr<char[]> out(new char[out_size]);
+            int read = unzReadCurrentFile(archive, in.get(), in_size);
+            ZSTD_frameHeader header;
+            if (read <= 0 || ZSTD_getFrameHeader(&header, in.get(), read) != 0 || !header.checksumFlag) {
+                error = "the delta has no checksum, applying it couldn't be verified";
+                return false;
+            }
+            size_t remaining = 1; // what ZSTD_decompressStream still expects, 0 once the frame and its checksum are done
+            while (read > 0) {
+                ZSTD_inBuffer input = { in.get(), (size_t)read, 0 };
+                while (input.pos < input.size) {
+                    ZSTD_outBuffer output_buffer = { out.get(), out_size, 0 };
+                    remaining = ZSTD_decompressStream(context.get(), &output_buffer, &input);
+                    if (ZSTD_isError(remaining)) { // checksum_wrong when the installed file isn't the one the patch expects
+                        error = ZSTD_getErrorName(remaining);
+                        return false;
+                    }
+                    if (!write(output, out.get(), output_buffer.pos)) {
+                        error = "is the card full?";
+                        return false;
+                    }
+                }
+                read = unzReadCurrentFile(archive, in.get(), in_size);
+            }
+            if (read < 0 || remaining != 0) {
+                error = "the patch is corrupt";
+                return false;
+            }
+            return true;
+        }
+
+        void removePending(const std::vector<Pending>& pending) {
+            for (const Pending& file : pending) {
+                std::error_code error;
+                std::filesystem::remove(file.pending, error);
+            }
+        }
+    }
+
+    std::string assetName(const std::string& tag) {
+        return ASSET_PREFIX + tag + ASSET_EXTENSION;
+    }
+
+    bool isPatchAsset(const std::string& filename) {
+        return filename.rfind(ASSET_PREFIX, 0) == 0 && endsWith(filename, ASSET_EXTENSION);
+    }
+
+    bool applyPatch(const std::string& archive, const std::string& root, zip::InstallIndex* index, PatchStats* stats, std::string* error, const zlib_filefunc64_def* io) {
+        std::string base = root;
+        if (!base.empty() && base.back() != '/')
+            base += '/';
+        PatchStats counts = { 0, 0, 0 };
+        std::vector<Pending> pending;
+        std::string message;
+
+        zlib_filefunc64_def functions;
+        if (io != nullptr)
+            functions = *io;
+        unzFile patch = io != nullptr ? unzOpen2_64(archive.c_str(), &functions) : unzOpen64(archive.c_str());
+        if (patch == nullptr)
+            message = "Couldn't open " + archive;
+        int result = patch != nullptr ? unzGoToFirstFile(patch) : UNZ_BADZIPFILE;
+        char name[MAX_NAME_LENGTH];
+        while (result == UNZ_OK && message.empty()) {
+            unz_file_info64 info;
+            if (unzGetCurrentFileInfo64(patch, &info, name, sizeof(name), nullptr, 0, nullptr, 0) != UNZ_OK)
+                break;
+            std::string entry = name;
+            bool delta = endsWith(entry, DELTA_EXTENSION);
+            std::string target = delta ? entry.substr(0, entry.size() - strlen(DELTA_EXTENSION)) : entry;
+            if (!zip::safeEntryName(entry)) {
+                message = entry + " points outside the install folder";
+                break;
+            }
+            if (entry.back() != '/') {
+                std::string path = base + target;
+                std::error_code ignored;
+                std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ignored);
+                Output output = { fopen((path + zip::PENDING_SUFFIX).c_str(), "wb"), 0, 0 };
+                if (output.file != nullptr)
+                    pending.push_back({ path + zip::PENDING_SUFFIX, path, 0, 0 });
+                if (output.file == nullptr || unzOpenCurrentFile(patch) != UNZ_OK) {
+                    if (output.file != nullptr)
+                        fclose(output.file);
+                    message = "Couldn't patch " + path;
+                    break;
+                }
+                std::string reason;
+                bool applied = delta ? applyDelta(patch, path, output, reason) : copyEntry(patch, output, reason);
+                applied = unzCloseCurrentFile(patch) == UNZ_OK && applied; // the entry's own CRC
+                applied = fclose(output.file) == 0 && applied;
+                if (!applied) {
+                    message = "Couldn't patch " + path + (reason.empty() ? "" : ", " + reason);
+                    break;
+                }
+                pending.back().crc = output.crc;
+                pending.back().size = output.size;
+                (delta ? counts.patched : counts.added)++;
+                counts.bytes += output.size;
+            }
+            result = unzGoToNextFile(patch);
+        }
+        if (patch != nullptr)
+            unzClose(patch);
+        if (message.empty() && result != UNZ_END_OF_LIST_OF_FILE)
+            message = archive + " is not a valid zip";
+        if (!message.empty()) {
+            removePending(pending);
+            if (error != nullptr)
+                *error = message;
+            return false;
+        }
+
+        bool moved = true;
+        for (const Pending& file : pending) { // every delta applied, now the installed files can go
+            std::error_code failed;
+            std::filesystem::remove(file.path, failed);
+            std::filesystem::rename(file.pending, file.path, failed);
+            if (failed) {
+                moved = false;
+                message = "Couldn't move " + file.path + " into place";
+                std::filesystem::remove(file.pending, failed);
+            }
+            if (index != nullptr)
+                index->Record(file.path, file.crc, file.size); // forgets the ones that didn't make it
+        }
+        if (stats != nullptr)
+            *stats = counts;
+        if (!moved && error != nullptr)
+            *error = message;
+        return moved;
+    }
+}
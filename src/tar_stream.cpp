@@ -0,0 +1,394 @@
+#include "tar_stream.hpp"
+#include "hash.hpp"
+#include "zip_stream.hpp"
+
+#include <zstd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace tar {
+
+    namespace { // tar stream detail stuff
+        static constexpr size_t WRITE_QUEUE_DEPTH = 8;
+        static constexpr size_t WRITE_BUFFER_SIZE = 256 * 1024;
+        static constexpr size_t MAX_METADATA_SIZE = 1024 * 1024; // long names and pax records, stops a broken size from eating memory
+        static constexpr size_t READ_CHUNK_SIZE = 256 * 1024;
+
+        // ustar header layout
+        static constexpr size_t NAME_OFFSET         = 0;
+        static constexpr size_t NAME_SIZE           = 100;
+        static constexpr size_t SIZE_OFFSET         = 124;
+        static constexpr size_t SIZE_SIZE           = 12;
+        static constexpr size_t CHECKSUM_OFFSET     = 148;
+        static constexpr size_t CHECKSUM_SIZE       = 8;
+        static constexpr size_t TYPE_OFFSET         = 156;
+        static constexpr size_t MAGIC_OFFSET        = 257;
+        static constexpr size_t PREFIX_OFFSET       = 345;
+        static constexpr size_t PREFIX_SIZE         = 155;
+
+        static constexpr char TYPE_FILE             = '0';
+        static constexpr char TYPE_OLD_FILE         = '\0';
+        static constexpr char TYPE_CONTIGUOUS       = '7';
+        static constexpr char TYPE_DIRECTORY        = '5';
+        static constexpr char TYPE_GNU_LONG_NAME    = 'L';
+        static constexpr char TYPE_PAX              = 'x';
+
+        std::string field(const std::string& block, size_t at, size_t size) {
+            const char* start = block.data() + at;
+            return std::string(start, strnlen(start, size));
+        }
+
+        /// Octal, NUL or space terminated, or GNU base-256 when the top bit of the first byte is set
+        bool parseNumber(const std::string& block, size_t at, size_t size, uint64_t& value) {
+            value = 0;
+            if ((uint8_t)block[at] & 0x80) {
+                for (size_t i = 0; i < size; i++)
+                    value = value << 8 | (uint8_t)(i == 0 ? block[at] & 0x7F : block[at + i]);
+                return true;
+            }
+            size_t i = 0;
+            while (i < size && block[at + i] == ' ')
+                i++;
+            bool digits = false;
+            for (; i < size && block[at + i] >= '0' && block[at + i] <= '7'; i++) {
+                value = value << 3 | (block[at + i] - '0');
+                digits = true;
+            }
+            return digits && (i == size || block[at + i] == ' ' || block[at + i] == '\0');
+        }
+
+        /// Sum of the header bytes with the checksum field counted as spaces
+        bool checksumMatches(const std::string& block) {
+            uint64_t expected;
+            if (!parseNumber(block, CHECKSUM_OFFSET, CHECKSUM_SIZE, expected))
+                return false;
+            uint64_t sum = 0;
+            for (size_t i = 0; i < BLOCK_SIZE; i++)
+                sum += i >= CHECKSUM_OFFSET && i < CHECKSUM_OFFSET + CHECKSUM_SIZE ? ' ' : (uint8_t)block[i];
+            return sum == expected;
+        }
+
+        /// "./foo" is how `tar -C dir .` spells "foo", "./" itself is the root
+        std::string stripDotSlash(std::string name) {
+            while (name.rfind("./", 0) == 0)
+                name.erase(0, 2);
+            return name;
+        }
+
+        /// Runs on the writer thread after the last write of a file, so closing never waits on the decoder
+        bool closeWritten(void* user_data, const char* data, size_t size) {
+            return fclose((FILE*)user_data) == 0;
+        }
+    }
+
+    bool isTarZst(const std::string& filename) {
+        std::string name = filename;
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        size_t length = strlen(ASSET_EXTENSION);
+        return name.size() > length && name.compare(name.size() - length, length, ASSET_EXTENSION) == 0;
+    }
+
+    StreamExtractor::StreamExtractor(const std::string& root, zip::InstallIndex* index)
+        : m_Root(root), m_Index(index), m_State(State::HEADER), m_Decoder(ZSTD_createDCtx(), ZSTD_freeDCtx),
+          m_Decoded(new char[ZSTD_DStreamOutSize()]), m_DecodedSize(ZSTD_DStreamOutSize()), m_FrameLeft(1), m_ZeroBlocks(0),
+          m_Remaining(0), m_Padding(0), m_MetadataType(0), m_File(nullptr), m_Crc(0), m_Size(0), m_Buffer(nullptr), m_Filled(0),
+          m_Position(0), m_WriteFailed(false), m_Writer(WRITE_QUEUE_DEPTH, WRITE_BUFFER_SIZE) {
+        if (!m_Root.empty() && m_Root.back() != '/')
+            m_Root += '/';
+        if (!m_Decoder)
+            Fail("Out of memory");
+        else
+            ZSTD_DCtx_setParameter(m_Decoder.get(), ZSTD_d_windowLogMax, WINDOW_LOG_MAX);
+    }
+
+    StreamExtractor::~StreamExtractor() {
+        Abort();
+    }
+
+    bool StreamExtractor::Fail(const std::string& error) {
+        if (m_State != State::FAILED)
+            m_Error = error;
+        m_State = State::FAILED;
+        if (m_Buffer != nullptr) {
+            m_Writer.Release(m_Buffer);
+            m_Buffer = nullptr;
+        }
+        CloseFile();
+        return false;
+    }
+
+    bool StreamExtractor::Feed(const char* data, size_t size) {
+        if (m_State == State::FAILED)
+            return false;
+        ZSTD_inBuffer input = { data, size, 0 };
+        ZSTD_outBuffer output;
+        do { // a full output buffer may leave decoded data behind even after all the input was taken
+            output = { m_Decoded.get(), m_DecodedSize, 0 };
+            size_t result = ZSTD_decompressStream(m_Decoder.get(), &output, &input);
+            if (ZSTD_isError(result))
+                return Fail(std::string("The archive is corrupt (") + ZSTD_getErrorName(result) + ")");
+            m_FrameLeft = result;
+            if (!FeedTar(m_Decoded.get(), output.pos))
+                return false;
+        } while (input.pos < input.size || output.pos == output.size);
+        return true;
+    }
+
+    bool StreamExtractor::FeedTar(const char* data, size_t size) {
+        while (size > 0) {
+            size_t used = 0;
+            switch (m_State) {
+                case State::HEADER:
+                    used = std::min(BLOCK_SIZE - m_Block.size(), size);
+                    m_Block.append(data, used);
+                    if (m_Block.size() == BLOCK_SIZE && !ParseHeader())
+                        return false;
+                    break;
+                case State::DATA:
+                    used = (size_t)std::min<uint64_t>(m_Remaining, size);
+                    if (m_File != nullptr && !WriteData(data, used))
+                        return false;
+                    m_Remaining -= used;
+                    if (m_Remaining == 0) {
+                        if (m_File != nullptr && !EndFile())
+                            return false;
+                        m_State = m_Padding > 0 ? State::PADDING : State::HEADER;
+                    }
+                    break;
+                case State::PADDING:
+                    used = std::min(m_Padding, size);
+                    m_Padding -= used;
+                    if (m_Padding == 0)
+                        m_State = State::HEADER;
+                    break;
+                case State::METADATA:
+                    used = (size_t)std::min<uint64_t>(m_Remaining, size);
+                    m_Metadata.append(data, used);
+                    m_Remaining -= used;
+                    if (m_Remaining == 0) {
+                        if (m_MetadataType == TYPE_GNU_LONG_NAME)
+                            m_LongName = std::string(m_Metadata.c_str());
+                        else
+                            ApplyPax();
+                        m_State = m_Padding > 0 ? State::PADDING : State::HEADER;
+                    }
+                    break;
+                case State::END: // the rest is the zero padding tar rounds archives up with
+                    return true;
+                case State::FAILED:
+                    return false;
+            }
+            data += used;
+            size -= used;
+        }
+        return true;
+    }
+
+    bool StreamExtractor::ParseHeader() {
+        std::string block;
+        block.swap(m_Block);
+        if (block.find_first_not_of('\0') == std::string::npos) {
+            if (++m_ZeroBlocks == 2)
+                m_State = State::END;
+            return true;
+        }
+        m_ZeroBlocks = 0;
+        if (!checksumMatches(block))
+            return Fail(m_Extracted.empty() && m_Names.empty() ? "Not a tar archive" : "A tar header is corrupt");
+
+        uint64_t size;
+        if (!parseNumber(block, SIZE_OFFSET, SIZE_SIZE, size))
+            return Fail("A tar header is corrupt");
+        char type = block[TYPE_OFFSET];
+        m_Remaining = size;
+        m_Padding = (BLOCK_SIZE - size % BLOCK_SIZE) % BLOCK_SIZE;
+        m_State = size > 0 ? State::DATA : State::HEADER;
+
+        if (type == TYPE_GNU_LONG_NAME || type == TYPE_PAX) {
+            if (size > MAX_METADATA_SIZE)
+                return Fail("A tar header is too large");
+            m_MetadataType = type;
+            m_Metadata.clear();
+            m_State = size > 0 ? State::METADATA : State::HEADER;
+            return true;
+        }
+
+        std::string name = m_LongName;
+        m_LongName.clear();
+        if (name.empty()) {
+            name = field(block, NAME_OFFSET, NAME_SIZE);
+            std::string prefix = block.compare(MAGIC_OFFSET, 5, "ustar") == 0 ? field(block, PREFIX_OFFSET, PREFIX_SIZE) : "";
+            if (!prefix.empty())
+                name = prefix + "/" + name;
+        }
+        name = stripDotSlash(name);
+        if (name.empty()) // the root itself
+            return true;
+        if (!zip::safeEntryName(name))
+            return Fail(name + " points outside the install folder");
+
+        if (type == TYPE_DIRECTORY) {
+            std::error_code error;
+            std::filesystem::create_directories(m_Root + name, error);
+            return true;
+        }
+        if (type != TYPE_FILE && type != TYPE_OLD_FILE && type != TYPE_CONTIGUOUS) // links, devices and global pax headers have nothing to install
+            return true;
+        if (!BeginFile(name))
+            return false;
+        return size > 0 || EndFile();
+    }
+
+    void StreamExtractor::ApplyPax() {
+        size_t at = 0; // "<length> <key>=<value>\n" records, the length counts the whole record
+        while (at < m_Metadata.size()) {
+            size_t space = m_Metadata.find(' ', at);
+            if (space == std::string::npos)
+                return;
+            size_t length = strtoull(m_Metadata.c_str() + at, nullptr, 10);
+            if (length == 0 || at + length > m_Metadata.size() || space >= at + length)
+                return;
+            std::string record = m_Metadata.substr(space + 1, at + length - space - 2); // without the newline
+            if (record.rfind("path=", 0) == 0)
+                m_LongName = record.substr(5);
+            at += length;
+        }
+    }
+
+    bool StreamExtractor::BeginFile(const std::string& name) {
+        if (!m_Names.insert(name).second)
+            return Fail(name + " is in the archive twice");
+        std::string path = m_Root + name;
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+        std::string pending = path + zip::PENDING_SUFFIX;
+        m_File = fopen(pending.c_str(), "wb");
+        if (m_File == nullptr)
+            return Fail("Couldn't create " + path);
+        m_Extracted.push_back({ pending, path, 0, 0 });
+        m_Crc = 0;
+        m_Size = 0;
+        m_Position = 0;
+        return true;
+    }
+
+    bool StreamExtractor::WriteData(const char* data, size_t size) {
+        m_Crc = hash::crc32(m_Crc, data, size);
+        m_Size += size;
+        while (size > 0) {
+            if (m_Buffer == nullptr) {
+                m_Buffer = m_Writer.Acquire();
+                m_Filled = 0;
+            }
+            size_t copied = std::min(m_Writer.BufferSize() - m_Filled, size);
+            memcpy(m_Buffer + m_Filled, data, copied);
+            m_Filled += copied;
+            data += copied;
+            size -= copied;
+            if (m_Filled == m_Writer.BufferSize())
+                SubmitBuffer();
+        }
+        return true;
+    }
+
+    void StreamExtractor::SubmitBuffer() {
+        m_Writer.Submit(m_File, m_Position, m_Buffer, m_Filled, &m_WriteFailed);
+        m_Position += m_Filled;
+        m_Buffer = nullptr;
+        m_Filled = 0;
+    }
+
+    void StreamExtractor::CloseFile() {
+        if (m_File == nullptr)
+            return;
+        // a job of its own, the writer skips the callback of a write that failed and the file would stay open
+        m_Writer.Submit(nullptr, 0, m_Writer.Acquire(), 0, &m_WriteFailed, closeWritten, m_File);
+        m_File = nullptr;
+    }
+
+    bool StreamExtractor::EndFile() {
+        if (m_Buffer != nullptr && m_Filled > 0)
+            SubmitBuffer();
+        else if (m_Buffer != nullptr) {
+            m_Writer.Release(m_Buffer);
+            m_Buffer = nullptr;
+        }
+        CloseFile();
+        m_Extracted.back().crc = m_Crc;
+        m_Extracted.back().size = m_Size;
+        return true;
+    }
+
+    bool StreamExtractor::Finish() {
+        if (m_State == State::FAILED)
+            return false;
+        if (m_State != State::END)
+            return Fail("The archive ended early");
+        if (m_FrameLeft != 0)
+            return Fail("The archive is cut short");
+        m_Writer.Sync();
+        if (m_WriteFailed) // only known now, write errors don't stop the decoder while it's running
+            return Fail("Couldn't write the files under " + m_Root + ", is the card full?");
+        return true;
+    }
+
+    bool StreamExtractor::Commit() {
+        if (m_State != State::END)
+            return false;
+        bool ok = true;
+        for (Extracted& file : m_Extracted) {
+            if (file.pending.empty())
+                continue;
+            std::error_code error;
+            std::filesystem::remove(file.path, error); // FAT can't rename over an existing file
+            std::filesystem::rename(file.pending, file.path, error);
+            if (error) {
+                m_Error = "Couldn't move " + file.path + " into place";
+                ok = false;
+                continue;
+            }
+            file.pending.clear();
+            if (m_Index != nullptr)
+                m_Index->Record(file.path, file.crc, file.size);
+        }
+        return ok;
+    }
+
+    void StreamExtractor::Abort() {
+        if (m_Buffer != nullptr) {
+            m_Writer.Release(m_Buffer);
+            m_Buffer = nullptr;
+        }
+        CloseFile();
+        m_Writer.Sync(); // every file is closed once the writer is through
+        for (Extracted& file : m_Extracted) {
+            if (file.pending.empty())
+                continue;
+            std::error_code error;
+            std::filesystem::remove(file.pending, error);
+            file.pending.clear();
+        }
+    }
+
+    bool extractArchive(const std::string& archive, const std::string& root, zip::InstallIndex* index, size_t* written, std::string* error) {
+        StreamExtractor extractor(root, index);
+        FILE* file = fopen(archive.c_str(), "rb");
+        bool ok = file != nullptr;
+        if (ok) {
+            std::unique_ptr<char[]> buffer(new char[READ_CHUNK_SIZE]);
+            size_t read;
+            while (ok && (read = fread(buffer.get(), 1, READ_CHUNK_SIZE, file)) > 0)
+                ok = extractor.Feed(buffer.get(), read);
+            ok = ok && !ferror(file);
+            fclose(file);
+        }
+        ok = ok && extractor.Finish() && extractor.Commit();
+        if (written != nullptr)
+            *written = extractor.Written();
+        if (!ok && error != nullptr)
+            *error = file == nullptr ? "Couldn't open " + archive : extractor.Error();
+        return ok;
+    }
+}
@@ -6,33 +6,7 @@ void pauseForText(int seconds) {
 }
 
 namespace { // CURL helper stuff
-    struct  CURL_builder {
-        CURL* request;
-        curl_slist* headers;
-
-        CURL_builder() : request(nullptr), headers(nullptr) { request = curl_easy_init(); }
-        ~CURL_builder() {
-            if (request != nullptr)
-                curl_easy_cleanup(request);
-            if (headers != nullptr)
-                curl_slist_free_all(headers);
-        }
-
-        operator bool() { return request != nullptr; } // for convenience
-        template <typename T>
-        CURL_builder& SetOPT(CURLoption opt, T param) { curl_easy_setopt(request, opt, param); return *this; } // generic to mimic the #define macro CURL uses
-        CURL_builder& SetHeaders(std::vector<std::string> _headers) {
-            if (headers != nullptr)
-                curl_slist_free_all(headers);
-            headers = nullptr;
-            for (std::string x : _headers)
-                headers = curl_slist_append(headers, x.c_str());
-            SetOPT(CURLOPT_HTTPHEADER, headers);
-            return *this;
-        }
-        CURL_builder& SetURL(const std::string& url) { SetOPT(CURLOPT_URL, url.c_str()); return *this; }
-        CURLcode Perform() { return curl_easy_perform(request); }
-    };
+    using net::CURL_builder; // every request goes through the session-wide connection pool
 
     std::string makeAuthHeader(gh::OauthToken token) {
         std::stringstream buffer; // it's better to use stringstreams instead of string + string + ... + string
@@ -40,11 +14,6 @@ namespace { // CURL helper stuff
         return buffer.str();
     }
 
-    size_t jsonWriteCallback(char* to_write, size_t size, size_t byte_count, void* user_data) {
-        *(std::stringstream*)user_data << to_write;
-        return size * byte_count;
-    }
-
     /*
     const int NUM_PROGRESS_CHARS = 50;
     void print_progress(size_t progress, size_t max) {
@@ -73,28 +42,33 @@ namespace { // CURL helper stuff
     }
     */
 
-    int download_progress(void* ptr, double TotalToDownload, double NowDownloaded, double TotalToUpload, double NowUploaded) {
+    bool download_progress(void* ptr, const net::DownloadProgress& progress) {
         consoleClear();
-        int percent_complete = (int)((NowDownloaded/TotalToDownload)*100.0);
+        int percent_complete = progress.total > 0 ? (int)(((double)progress.now/progress.total)*100.0) : 0;
         std::cout << WHITE "\n\nDownloading... " << percent_complete << "%\n" RESET;
+        if (progress.count > 1)
+            std::cout << "\nDownloading multiple files... " GREEN "(" << progress.finished << "/" << progress.count << " done)\n" RESET;
         //print_progress( percent_complete, 100 ); // percent out of 100
-        std::cout << "\nPress B to cancel\n";
+        std::cout << "\nPress B to cancel, the next attempt resumes where this one stopped\n";
         consoleUpdate(NULL);
 
         hidScanInput();
         u64 kDown = hidKeysDown(CONTROLLER_P1_AUTO);
         if (kDown & KEY_B) {
-            return 1;
+            return false;
         }
 
-        // if you don't return 0, the transfer will be aborted
-        return 0; 
+        // if you don't return true, the transfers will be aborted
+        return true; 
     }
 }
 
 namespace gh {
 
     namespace { // gh detail stuff
+        std::string api_root = "https://api.github.com";
+        Backend backend = Backend::REST;
+
         enum GithubPermissions {
             NONE = 0x0,
             ADMIN = 0x1,
@@ -127,50 +101,103 @@ namespace gh {
         	return a;
         }
 
+        struct CachedPermissions {
+            GithubPermissions permissions;
+            std::chrono::steady_clock::time_point fetched;
+        };
+        constexpr std::chrono::minutes PERMISSIONS_TTL(10); // collaborator changes are rare, a session rarely lasts longer than this
+        std::mutex permissions_lock;
+        std::map<std::pair<std::string, std::string>, CachedPermissions> permissions_cache; // keyed by (token, repository)
+
+        std::pair<std::string, std::string> permissionsKey(OauthToken token, const std::string& full_name) {
+            return { token != nullptr ? token : "", full_name };
+        }
+
+        bool lookupPermissions(OauthToken token, const std::string& full_name, GithubPermissions& repo_perms) {
+            std::lock_guard<std::mutex> guard(permissions_lock);
+            auto found = permissions_cache.find(permissionsKey(token, full_name));
+            if (found == permissions_cache.end())
+                return false;
+            if (std::chrono::steady_clock::now() - found->second.fetched > PERMISSIONS_TTL) {
+                permissions_cache.erase(found);
+                return false;
+            }
+            repo_perms = found->second.permissions;
+            return true;
+        }
+
+        void storePermissions(OauthToken token, const std::string& full_name, GithubPermissions repo_perms) {
+            std::lock_guard<std::mutex> guard(permissions_lock);
+            permissions_cache[permissionsKey(token, full_name)] = { repo_perms, std::chrono::steady_clock::now() };
+        }
+
+        /// token: User authentication token the request was made with
+        /// http_code: Status code of the /repos/{full_name} response
+        /// body: Body of the /repos/{full_name} response
+        /// repo_perms: Receives the permissions the user has on the repository
+        /// Returns false if the response is not a definite answer (network error, rate limit...), those must not be cached
+        bool parsePermissions(OauthToken token, long http_code, const std::string& body, GithubPermissions& repo_perms) {
+            repo_perms = GithubPermissions::NONE;
+            if (http_code == 404) // private repositories we can't see are reported as missing
+                return true;
+            if (http_code != 200)
+                return false;
+            json parsed;
+            try { parsed = json::parse(body); }
+            catch (json::parse_error& e) { return false; }
+            if (!parsed.is_object() || !parsed.contains("full_name")) // a bad response won't contain the full_name key 
+                return false;
+            if (token == nullptr) { // if we are this far and there is no user, it is a public repository
+                repo_perms = GithubPermissions::PULL;
+                return true;
+            }
+            json perms_list = parsed["permissions"];
+            if (!perms_list.is_object())
+                return false;
+            if (perms_list.value("admin", false)) repo_perms |= GithubPermissions::ADMIN;
+            if (perms_list.value("push", false)) repo_perms |= GithubPermissions::PUSH;
+            if (perms_list.value("pull", false)) repo_perms |= GithubPermissions::PULL;
+            return true;
+        }
+
+        bool fetchPermissions(OauthToken token, const std::string& full_name, GithubPermissions& repo_perms) {
+            net::Request request = { api_root + "/repos/" + full_name, {} };
+            if (token != nullptr)
+                request.headers.push_back(makeAuthHeader(token));
+            request.cached = true;
+            net::perform(request);
+            if (request.result != CURLE_OK)
+                return false;
+            return parsePermissions(token, request.http_code, request.body, repo_perms);
+        }
+
         /// token: User authentication token. If (token == nullptr), this function will return perform the check if it is a public repository
         /// full_name: Name of the repository
         /// permissions: The permission set to be checked
+        /// Answers from the session cache when the repository was already checked with the same token
         bool userHasPermissions(OauthToken token, const std::string& full_name, GithubPermissions permissions) {
-            bool ret = false;
             if (token == nullptr && (permissions & ~GithubPermissions::PULL) != 0) // Even if we have read access, we won't have any other perms
-                return ret;
-            CURL_builder curl;
-            if (curl) {
-                START_BREAKABLE
-                if (token != nullptr)
-                    curl.SetHeaders({ makeAuthHeader(token) });
-                
-                std::stringstream buffer;
-                buffer << "https://api.github.com/repos/" << full_name;
-                std::string api_url = buffer.str();
-                buffer.str(""); buffer.clear(); // clears bits and set string to nothing
-                CURLcode result =
-                    curl.SetURL(api_url.c_str())
-                        .SetOPT(CURLOPT_WRITEDATA, &buffer)
-                        .SetOPT(CURLOPT_WRITEFUNCTION, jsonWriteCallback)
-                        .SetOPT(CURLOPT_USERAGENT, "HDR-User")
-                        .Perform();
-                json parsed;
-                try { parsed = json::parse(buffer.str()); }
-                catch (json::parse_error& e) { break; }
-                if (!parsed.is_object() || !parsed.contains("full_name")) // a bad response won't contain the full_name key 
-                    break;
-                if (token == nullptr) { // if we are this far and there is no user, it is a public repository
-                    ret = true;
-                    break;
-                }
-                json perms_list = parsed["permissions"];
-                GithubPermissions repo_perms = GithubPermissions::NONE;
-                if (perms_list["admin"].get<bool>()) repo_perms |= GithubPermissions::ADMIN;
-                if (perms_list["push"].get<bool>()) repo_perms |= GithubPermissions::PUSH;
-                if (perms_list["pull"].get<bool>()) repo_perms |= GithubPermissions::PULL;
-                ret = ((repo_perms & permissions) == permissions);
-                END_BREAKABLE
+                return false;
+            GithubPermissions repo_perms = GithubPermissions::NONE;
+            if (!lookupPermissions(token, full_name, repo_perms)) {
+                if (!fetchPermissions(token, full_name, repo_perms))
+                    return false;
+                storePermissions(token, full_name, repo_perms);
             }
-            return ret;
+            return ((repo_perms & permissions) == permissions);
         }
     }
 
+    void invalidatePermissions(OauthToken token, const std::string& repository) {
+        std::lock_guard<std::mutex> guard(permissions_lock);
+        permissions_cache.erase(permissionsKey(token, repository));
+    }
+
+    void invalidatePermissions() {
+        std::lock_guard<std::mutex> guard(permissions_lock);
+        permissions_cache.clear();
+    }
+
     bool isEndUser(OauthToken token) {
         return userHasPermissions(token, RELEASE_REPO, GithubPermissions::PULL);
     }
@@ -183,44 +210,392 @@ namespace gh {
         return userHasPermissions(token, DEV_REPO, GithubPermissions::PULL);
     }
 
+    namespace { // release list helpers
+        std::string releasesUrl(const std::string& repository) {
+            std::stringstream buffer;
+            buffer << api_root << "/repos/" << repository << "/releases?per_page=" << RELEASES_PER_PAGE;
+            return buffer.str();
+        }
+
+        /// Base for the SAX handlers below, everything they don't care about is skipped without being stored
+        struct SkippingSax : nlohmann::json_sax<json> {
+            size_t depth = 0;
+            std::string current_key;
+
+            bool null() override { return true; }
+            bool boolean(bool val) override { return true; }
+            bool number_integer(number_integer_t val) override { return true; }
+            bool number_unsigned(number_unsigned_t val) override { return true; }
+            bool number_float(number_float_t val, const string_t& s) override { return true; }
+            bool binary(binary_t& val) override { return true; }
+            bool key(string_t& val) override { current_key = val; return true; }
+            bool parse_error(size_t position, const std::string& last_token, const nlohmann::detail::exception& ex) override { return false; }
+        };
+
+        /// Picks name, tag_name and body out of every release of a /releases response, without building the DOM
+        struct ReleaseListSax : SkippingSax {
+            std::vector<Release>& releases;
+            bool is_array = false;
+            Release current;
+            int fields = 0;
+
+            ReleaseListSax(std::vector<Release>& out) : releases(out) {}
+
+            bool string(string_t& val) override {
+                if (depth != 2) // only fields of the release objects themselves, not of their author or assets
+                    return true;
+                if (current_key == "name") { current.name = std::move(val); fields |= 0x1; }
+                else if (current_key == "tag_name") { current.tag = std::move(val); fields |= 0x2; }
+                else if (current_key == "body") current.body = std::move(val); // null or missing reads as empty, like the GraphQL description
+                return true;
+            }
+            bool start_object(size_t elements) override {
+                if (++depth == 1) // results come in a json array
+                    return false;
+                if (depth == 2) {
+                    current = {};
+                    fields = 0;
+                }
+                return true;
+            }
+            bool end_object() override {
+                if (depth-- == 2 && fields == 0x3)
+                    releases.push_back(std::move(current));
+                return true;
+            }
+            bool start_array(size_t elements) override {
+                if (++depth == 1)
+                    is_array = true;
+                return true;
+            }
+            bool end_array() override { depth--; return true; }
+        };
+
+        /// Picks url, content_type, name, size and digest out of every asset of a /releases/tags/{tag} response, plus the release body
+        struct ReleaseAssetsSax : SkippingSax {
+            AssetInfos& assets;
+            std::string& release_body;
+            bool in_assets = false;    // inside the top level "assets" array
+            bool found_assets = false;
+            AssetInfo current;
+            int fields = 0;
+
+            ReleaseAssetsSax(AssetInfos& out, std::string& body) : assets(out), release_body(body) {}
+
+            bool string(string_t& val) override {
+                if (depth == 1 && current_key == "body")
+                    release_body = std::move(val);
+                if (!in_assets || depth != 3)
+                    return true;
+                if (current_key == "url") { current.url = std::filesystem::path(val); fields |= 0x1; }
+                else if (current_key == "content_type") { current.content_type = std::move(val); fields |= 0x2; }
+                else if (current_key == "name") { current.filename = std::move(val); fields |= 0x4; }
+                else if (current_key == "digest" && val.rfind("sha256:", 0) == 0) current.sha256 = hash::findSha256(val);
+                return true;
+            }
+            bool number_unsigned(number_unsigned_t val) override {
+                if (in_assets && depth == 3 && current_key == "size")
+                    current.size = val;
+                return true;
+            }
+            bool start_object(size_t elements) override {
+                if (++depth == 3 && in_assets) {
+                    current = {};
+                    fields = 0;
+                }
+                return true;
+            }
+            bool end_object() override {
+                if (depth-- == 3 && in_assets && fields == 0x7)
+                    assets.push_back(std::move(current));
+                return true;
+            }
+            bool start_array(size_t elements) override {
+                if (++depth == 2 && current_key == "assets") {
+                    in_assets = true;
+                    found_assets = true;
+                }
+                return true;
+            }
+            bool end_array() override {
+                if (depth-- == 2)
+                    in_assets = false;
+                return true;
+            }
+        };
+
+        bool parseReleases(const std::string& body, std::vector<Release>& releases) {
+            ReleaseListSax sax(releases);
+            return json::sax_parse(body, &sax) && sax.is_array;
+        }
+
+        bool parseReleaseAssets(const std::string& body, AssetInfos& assets, std::string& release_body) {
+            ReleaseAssetsSax sax(assets, release_body);
+            return json::sax_parse(body, &sax) && sax.found_assets;
+        }
+
+        /// Picks digests out of "<sha256>  <filename>" style lines (sha256sum output, SHA256SUMS files, release notes)
+        void applyPublishedDigests(const std::string& text, AssetInfos& assets) {
+            std::stringstream lines(text);
+            std::string line;
+            while (std::getline(lines, line)) {
+                std::string digest = hash::findSha256(line);
+                if (digest.empty())
+                    continue;
+                for (AssetInfo& asset : assets) {
+                    size_t found = line.find(asset.filename);
+                    size_t end = found + asset.filename.size();
+                    bool whole_name = found != std::string::npos && (end == line.size() || !(isalnum((unsigned char)line[end]) || line[end] == '.' || line[end] == '_' || line[end] == '-'));
+                    if (asset.sha256.empty() && whole_name) // a.zip must not pick up the line of a.zip.sha256
+                        asset.sha256 = digest;
+                }
+            }
+        }
+    }
+
     std::vector<Release> getReleases(OauthToken token, const std::string& repository) {
         std::vector<Release> ret = std::vector<Release>();
         if (!userHasPermissions(token, repository, GithubPermissions::PULL))
             return ret;
-        CURL_builder curl;
-        if (curl) {
-            START_BREAKABLE
-            if (token != nullptr)
-                curl.SetHeaders({ makeAuthHeader(token) });
-            
+        std::string url = releasesUrl(repository);
+        while (!url.empty()) { // follows the Link headers until the last page
+            ReleasePage page = getReleasePage(token, url);
+            ret.insert(ret.end(), page.releases.begin(), page.releases.end());
+            url = page.next_page;
+        }
+        return ret;
+    }
+
+    ReleasePage getReleasePage(OauthToken token, const std::string& url) {
+        ReleasePage ret = { false, false, {}, "" };
+        net::Request request = { url, {} };
+        if (token != nullptr)
+            request.headers.push_back(makeAuthHeader(token));
+        request.cached = true;
+        net::perform(request);
+        if (request.result == CURLE_OK && request.http_code == 200 && parseReleases(request.body, ret.releases)) {
+            ret.fetched = true;
+            ret.next_page = request.next_page;
+        }
+        else // GitHub answers rate limits with 403 or 429, a bad token or a missing repository stays bad
+            ret.retryable = request.result != CURLE_OK || request.http_code >= 500 || request.http_code == 403 || request.http_code == 429;
+        return ret;
+    }
+
+    namespace { // GraphQL backend
+        std::mutex assets_lock;
+        std::map<std::pair<std::string, std::string>, AssetInfos> public_assets; // (repository, tag) -> assets, public repositories only
+
+        /// READ and TRIAGE only give read access, WRITE and MAINTAIN can push
+        GithubPermissions graphqlPermissions(const json& viewer_permission) {
+            if (!viewer_permission.is_string())
+                return GithubPermissions::NONE;
+            std::string permission = viewer_permission.get<std::string>();
+            if (permission == "ADMIN")
+                return GithubPermissions::ADMIN | GithubPermissions::PUSH | GithubPermissions::PULL;
+            if (permission == "MAINTAIN" || permission == "WRITE")
+                return GithubPermissions::PUSH | GithubPermissions::PULL;
+            if (permission == "TRIAGE" || permission == "READ")
+                return GithubPermissions::PULL;
+            return GithubPermissions::NONE;
+        }
+
+        /// pageInfo of a connection, a missing one (not asked for, or null in a partial answer) reads as the last page
+        bool hasNextPage(json& connection) {
+            return connection["pageInfo"].is_object() && connection["pageInfo"].value("hasNextPage", false);
+        }
+
+        std::string graphqlQuery(const std::vector<std::string>& repositories) {
             std::stringstream buffer;
-            buffer << "https://api.github.com/repos/" << repository << "/releases";
-            std::string api_url = buffer.str();
-            buffer.str(""); buffer.clear(); // clears bits and set string to nothing
-
-
-            CURLcode result =
-                curl.SetURL(api_url.c_str())
-                    .SetOPT(CURLOPT_WRITEDATA, &buffer)
-                    .SetOPT(CURLOPT_WRITEFUNCTION, jsonWriteCallback)
-                    .SetOPT(CURLOPT_USERAGENT, "HDR-User")
-                    .Perform();
-            if (result != CURLE_OK)
-                break;
+            buffer << "query {";
+            for (size_t i = 0; i < repositories.size(); i++) {
+                size_t slash = repositories[i].find('/');
+                buffer << " r" << i << ": repository(owner: " << json(repositories[i].substr(0, slash)).dump()
+                       << ", name: " << json(repositories[i].substr(slash + 1)).dump() << ") {"
+                       << " viewerPermission isPrivate"
+                       << " releases(first: " << RELEASES_PER_PAGE << ", orderBy: { field: CREATED_AT, direction: DESC }) {"
+                       << " pageInfo { hasNextPage }"
+                       << " nodes { name tagName description releaseAssets(first: " << ASSETS_PER_RELEASE << ") {"
+                       << " pageInfo { hasNextPage } nodes { name contentType size downloadUrl } } } } }";
+            }
+            buffer << " }";
+            return buffer.str();
+        }
+
+        /// One request for the permissions, releases and release assets of every repository. Returns false if the
+        /// request failed as a whole, repositories the user can't see come back as a null field and no access
+        bool getChannelsGraphQL(OauthToken token, const std::vector<std::string>& repositories, std::vector<Channel>& channels) {
+            net::Request request = { api_root + "/graphql", { makeAuthHeader(token), "Content-Type: application/json" } };
+            request.post_body = json({ { "query", graphqlQuery(repositories) } }).dump();
+            net::perform(request);
+            if (request.result != CURLE_OK || request.http_code != 200)
+                return false;
             json parsed;
-            try { parsed = json::parse(buffer.str()); }
-            catch (json::parse_error& e) { break; }
-            if (!parsed.is_array()) // results come in a json array
-                break;
-            for (auto& x : parsed.items()) {
-                auto value = x.value();
-                if (!value.contains("name") || !value.contains("tag_name") || !value.contains("body"))
+            try { parsed = json::parse(request.body); }
+            catch (json::parse_error& e) { return false; }
+            if (!parsed.is_object() || !parsed["data"].is_object())
+                return false;
+            json& data = parsed["data"];
+
+            channels.clear();
+            for (size_t i = 0; i < repositories.size(); i++) {
+                Channel channel = { repositories[i], false, true, {}, "" };
+                json& repo = data["r" + std::to_string(i)];
+                GithubPermissions repo_perms = repo.is_object() ? graphqlPermissions(repo["viewerPermission"]) : GithubPermissions::NONE;
+                storePermissions(token, repositories[i], repo_perms);
+                channel.has_access = (repo_perms & GithubPermissions::PULL) == GithubPermissions::PULL;
+                if (!channel.has_access || !repo["releases"].is_object()) {
+                    channels.push_back(channel);
                     continue;
-                ret.push_back({ value["name"].get<std::string>(), value["tag_name"].get<std::string>(), value["body"].get<std::string>() });
+                }
+                bool is_public = !repo.value("isPrivate", true);
+                for (auto& x : repo["releases"]["nodes"].items()) {
+                    auto value = x.value();
+                    if (!value["name"].is_string() || !value["tagName"].is_string())
+                        continue;
+                    Release release = { value["name"].get<std::string>(), value["tagName"].get<std::string>(), value["description"].is_string() ? value["description"].get<std::string>() : "" };
+                    channel.releases.push_back(release);
+                    if (!is_public || !value["releaseAssets"].is_object() || hasNextPage(value["releaseAssets"]))
+                        continue; // a partial list isn't kept, getReleaseInfos asks REST for the whole one
+                    // browser download urls only work without a session for public repositories, private ones go through the REST asset ids
+                    AssetInfos assets;
+                    bool complete = true;
+                    for (auto& a : value["releaseAssets"]["nodes"].items()) {
+                        auto asset = a.value();
+                        if (!asset.is_object() || !asset["downloadUrl"].is_string() || !asset["name"].is_string()) {
+                            complete = false; // null in a partial answer, REST has the asset
+                            break;
+                        }
+                        assets.push_back({ std::filesystem::path(asset["downloadUrl"].get<std::string>()), asset["contentType"].is_string() ? asset["contentType"].get<std::string>() : "",
+                                           asset["name"].get<std::string>(), asset["size"].is_number_unsigned() ? asset["size"].get<size_t>() : 0 });
+                    }
+                    if (!complete)
+                        continue;
+                    applyPublishedDigests(release.body, assets);
+                    std::lock_guard<std::mutex> guard(assets_lock);
+                    public_assets[{ repositories[i], release.tag }] = assets;
+                }
+                if (hasNextPage(repo["releases"])) // the REST pager takes over from the second page
+                    channel.next_page = releasesUrl(repositories[i]) + "&page=2";
+                channels.push_back(channel);
             }
-            END_BREAKABLE
+            return true;
         }
-        return ret;
+
+        std::vector<Channel> getChannelsREST(OauthToken token, const std::vector<std::string>& repositories) {
+            std::vector<Channel> ret;
+            std::vector<std::string> headers;
+            if (token != nullptr)
+                headers.push_back(makeAuthHeader(token));
+
+            // every repository gets a permission check (unless it is already cached) and a release list request, all sent at once
+            std::vector<net::Request> requests;
+            std::vector<int> permission_request(repositories.size(), -1);
+            std::vector<int> releases_request(repositories.size(), -1);
+            for (size_t i = 0; i < repositories.size(); i++) {
+                ret.push_back({ repositories[i], false, false, {}, "" });
+                GithubPermissions repo_perms = GithubPermissions::NONE;
+                if (lookupPermissions(token, repositories[i], repo_perms)) {
+                    ret[i].has_access = (repo_perms & GithubPermissions::PULL) == GithubPermissions::PULL;
+                    ret[i].fetched = !ret[i].has_access;
+                    if (!ret[i].has_access)
+                        continue;
+                }
+                else {
+                    permission_request[i] = requests.size();
+                    requests.push_back({ api_root + "/repos/" + repositories[i], headers, true });
+                }
+                releases_request[i] = requests.size();
+                requests.push_back({ releasesUrl(repositories[i]), headers, true });
+            }
+            net::performBatch(requests);
+
+            for (size_t i = 0; i < repositories.size(); i++) {
+                if (permission_request[i] != -1) {
+                    const net::Request& request = requests[permission_request[i]];
+                    GithubPermissions repo_perms = GithubPermissions::NONE;
+                    if (request.result != CURLE_OK || !parsePermissions(token, request.http_code, request.body, repo_perms))
+                        continue; // no definite answer, fetched stays false
+                    storePermissions(token, repositories[i], repo_perms);
+                    ret[i].has_access = (repo_perms & GithubPermissions::PULL) == GithubPermissions::PULL;
+                    ret[i].fetched = !ret[i].has_access;
+                }
+                if (!ret[i].has_access || releases_request[i] == -1)
+                    continue;
+                const net::Request& request = requests[releases_request[i]];
+                if (request.result == CURLE_OK && request.http_code == 200) {
+                    ret[i].fetched = parseReleases(request.body, ret[i].releases);
+                    ret[i].next_page = request.next_page; // later pages are only fetched once the menu gets there
+                }
+            }
+            return ret;
+        }
+    }
+
+    void setApiRoot(const std::string& root) {
+        api_root = root;
+    }
+
+    void setBackend(Backend selected) {
+        backend = selected;
+    }
+
+    std::vector<Channel> getChannels(OauthToken token, const std::vector<std::string>& repositories) {
+        std::vector<Channel> ret;
+        if (backend == Backend::GRAPHQL && token != nullptr && getChannelsGraphQL(token, repositories, ret)) // GraphQL needs a token
+            return ret;
+        return getChannelsREST(token, repositories);
+    }
+
+    namespace { // snapshot helpers
+        std::string snapshotPath() {
+            std::stringstream buffer;
+            buffer << APP_PATH << SNAPSHOT_FILE;
+            return buffer.str();
+        }
+
+        std::string tokenFingerprint(OauthToken token) { // the snapshot only belongs to the user who fetched it, without storing the token twice
+            return net::cacheKey("snapshot", { token != nullptr ? token : "" });
+        }
+    }
+
+    bool loadChannelSnapshot(OauthToken token, std::vector<Channel>& channels) {
+        std::ifstream file(snapshotPath(), std::ios_base::in);
+        if (!file.is_open())
+            return false;
+        channels.clear();
+        try {
+            json parsed = json::parse(file);
+            if (!parsed.is_object() || parsed.value("user", "") != tokenFingerprint(token) || !parsed["channels"].is_array())
+                return false;
+            for (auto& x : parsed["channels"].items()) {
+                auto value = x.value();
+                Channel channel = { value.value("repository", ""), value.value("has_access", false), false, {}, value.value("next_page", "") };
+                for (auto& r : value["releases"].items()) {
+                    auto release = r.value();
+                    channel.releases.push_back({ release.value("name", ""), release.value("tag", ""), release.value("body", "") });
+                }
+                channels.push_back(channel);
+            }
+        }
+        catch (json::exception& e) { // not json, or a field of the wrong type, the menu waits for the network instead
+            channels.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void saveChannelSnapshot(OauthToken token, const std::vector<Channel>& channels) {
+        json snapshot = { { "user", tokenFingerprint(token) }, { "channels", json::array() } };
+        for (const Channel& channel : channels) {
+            json releases = json::array();
+            for (const Release& release : channel.releases)
+                releases.push_back({ { "name", release.name }, { "tag", release.tag }, { "body", release.body } });
+            snapshot["channels"].push_back({ { "repository", channel.repository }, { "has_access", channel.has_access }, { "releases", releases }, { "next_page", channel.next_page } });
+        }
+        std::ofstream file(snapshotPath(), std::ios_base::out | std::ios_base::trunc);
+        if (file.is_open())
+            file << snapshot.dump();
     }
 
     
@@ -231,125 +606,563 @@ namespace gh {
             pauseForText(2);
             return ret;
         }
-        CURL_builder curl;
-        if (curl) {
-            START_BREAKABLE
-            if (token != nullptr) {
-                curl.SetHeaders({ makeAuthHeader(token) });
-            }
-            else {
-                std::cout << RED "\nInvalid token passed!\n" RESET;
-                pauseForText(2);
-            }
-            
-            std::stringstream buffer;
-            buffer << "https://api.github.com/repos/" << repository << "/releases/tags/" << tag;
-            std::string api_url = buffer.str();
-            buffer.str(""); buffer.clear();
-
-            CURLcode result =
-                curl.SetURL(api_url.c_str())
-                    .SetOPT(CURLOPT_WRITEDATA, &buffer)
-                    .SetOPT(CURLOPT_WRITEFUNCTION, jsonWriteCallback)
-                    .SetOPT(CURLOPT_USERAGENT, "HDR-User")
-                    .Perform();
-            if (result != CURLE_OK) {
-                std::cout << RED "\nBad curl attempt\n" RESET;
-                pauseForText(2);
-                break;
-            }
-            json parsed;
-            try { parsed = json::parse(buffer.str()); }
-            catch (json::parse_error& e) { break; }
-            if (!parsed.is_object() || !parsed.contains("assets")) {
-                std::cout << RED "\nFailed to parse json properly\n" RESET;
-                pauseForText(2);
-                break;
-            }
-            json assets = parsed["assets"];
-            for (auto& x : assets.items()) {
-                auto value = x.value();
-                ret.push_back({ 
-                    std::filesystem::path(value["url"].get<std::string>()), 
-                    value["content_type"].get<std::string>(),
-                    value["name"].get<std::string>()
-                });
-            }
-            END_BREAKABLE
+        {
+            std::lock_guard<std::mutex> guard(assets_lock);
+            auto found = public_assets.find({ repository, tag });
+            if (found != public_assets.end() && !found->second.empty())
+                return found->second;
+        }
+        START_BREAKABLE
+        std::stringstream buffer;
+        buffer << api_root << "/repos/" << repository << "/releases/tags/" << tag;
+        net::Request request = { buffer.str(), {} };
+        if (token != nullptr) {
+            request.headers.push_back(makeAuthHeader(token));
         }
         else {
-            std::cout << RED "\nFailed to build CURL object\n" RESET;
+            std::cout << RED "\nInvalid token passed!\n" RESET;
+            pauseForText(2);
+        }
+        request.cached = true;
+        net::perform(request);
+        if (request.result != CURLE_OK) {
+            std::cout << RED "\nBad curl attempt\n" RESET;
             pauseForText(2);
+            break;
         }
+        std::string release_body;
+        if (!parseReleaseAssets(request.body, ret, release_body)) {
+            std::cout << RED "\nFailed to parse json properly\n" RESET;
+            pauseForText(2);
+            ret.clear();
+            break;
+        }
+        applyPublishedDigests(release_body, ret);
+        END_BREAKABLE
         return ret;
     }
 
-    DownloadResult downloadRelease(OauthToken token, const std::string& repository, const std::string& tag, const std::string& filepath_root) {
-        DownloadResult ret = DownloadResult::CURL_ERROR;
-        if (!userHasPermissions(token, repository, GithubPermissions::PULL))
-            return ret;
-        CURL_builder curl;
-        if (curl) {
-            START_BREAKABLE
-            AssetInfos assets = getReleaseInfos(token, repository, tag);
-            if (assets.size() < 1) {
-                ret = DownloadResult::DOES_NOT_EXIST;
-                break;
+    namespace { // install helpers
+        /// Receives the assets as their downloads complete, so extraction overlaps with the downloads still running
+        struct Installer {
+            const AssetInfos* assets;
+            const std::vector<net::Download>* downloads;
+            const std::vector<std::unique_ptr<zip::StreamExtractor>>* extractors; // set for zips that were extracted while downloading
+            const std::vector<std::unique_ptr<tar::StreamExtractor>>* tar_extractors; // same for .tar.zst
+            std::vector<std::unique_ptr<std::string>>* bodies; // set for zips that were downloaded to RAM
+            std::string filepath_root;
+            zip::InstallIndex* index; // nullptr unless the install is incremental
+            std::mutex lock;
+            std::condition_variable wake;
+            std::deque<size_t> ready;
+            bool closed;
+            // only touched by the installer thread until it is joined
+            bool failed;
+            InstallStats stats;
+        };
+
+        /// Returns false if a zip turned out to be broken or its files couldn't be written
+        /// Keeps the first failure for the result screen, the later ones are often just fallout of it
+        bool extractionFailed(Installer& installer, const AssetInfo& asset, const std::string& error) {
+            if (installer.stats.error.empty())
+                installer.stats.error = asset.filename + ": " + (error.empty() ? "couldn't be extracted" : error);
+            return false;
+        }
+
+        bool installAsset(Installer& installer, size_t index) {
+            const AssetInfo& asset = (*installer.assets)[index];
+            const std::string& path = (*installer.downloads)[index].path;
+            zip::StreamExtractor* extractor = (*installer.extractors)[index].get();
+            if (extractor != nullptr) { // already on the card, the checksum passed so the files can replace the old ones
+                bool committed = extractor->Finish() && extractor->Commit();
+                installer.stats.written += extractor->Written();
+                installer.stats.skipped += extractor->Skipped();
+                return committed || extractionFailed(installer, asset, extractor->Error());
+            }
+            tar::StreamExtractor* tar_extractor = (*installer.tar_extractors)[index].get();
+            if (tar_extractor != nullptr) {
+                bool committed = tar_extractor->Finish() && tar_extractor->Commit();
+                installer.stats.written += tar_extractor->Written();
+                return committed || extractionFailed(installer, asset, tar_extractor->Error());
+            }
+            std::unique_ptr<std::string>& body = (*installer.bodies)[index];
+            if (body) { // the card only sees the extracted files
+                zip::MemoryArchive archive = { body->data(), body->size() };
+                zlib_filefunc64_def io;
+                zip::fillMemoryFileFunctions(&io, &archive);
+                zip::ExtractStats stats = {};
+                std::string error;
+                bool extracted = zip::extractParallel(asset.filename, SYSTEM_ROOT, settings.extract_threads, &stats, &error, installer.index, &io);
+                body.reset();
+                installer.stats.written += stats.entries;
+                installer.stats.skipped += stats.skipped;
+                return extracted || extractionFailed(installer, asset, error);
+            }
+            if (std::filesystem::exists(path) && asset.content_type == "application/zip") { // if it's a zip, extract to root then delete it
+                //if (!std::filesystem::exists(TMP_EXTRACTED))
+                    //std::filesystem::create_directories(TMP_EXTRACTED);
+                zlib_filefunc64_def io;
+                zip::fillBufferedFileFunctions(&io);
+                zip::ExtractStats stats = {};
+                std::string error;
+                bool extracted = zip::extractParallel(path, SYSTEM_ROOT/*TMP_EXTRACTED*/, settings.extract_threads, &stats, &error, installer.index, &io);
+                std::filesystem::remove(path);
+                installer.stats.written += stats.entries;
+                installer.stats.skipped += stats.skipped;
+                return extracted || extractionFailed(installer, asset, error);
             }
+            if (std::filesystem::exists(path) && tar::isTarZst(asset.filename)) { // downloaded to the card with stream extraction off
+                size_t written = 0;
+                std::string error;
+                bool extracted = tar::extractArchive(path, SYSTEM_ROOT, installer.index, &written, &error);
+                std::filesystem::remove(path);
+                installer.stats.written += written;
+                return extracted || extractionFailed(installer, asset, error);
+            }
+            else { // otherwise, just rename the file to it's proper name instead of it's asset id
+                std::filesystem::path new_path = installer.filepath_root + asset.filename;
+                rename(path.c_str(), new_path.c_str());
+                installer.stats.written++;
+            }
+            return true;
+        }
 
+        void installerThread(Installer* installer) {
+            while (true) {
+                size_t index;
+                {
+                    std::unique_lock<std::mutex> guard(installer->lock);
+                    installer->wake.wait(guard, [installer] { return !installer->ready.empty() || installer->closed; });
+                    if (installer->ready.empty())
+                        return;
+                    index = installer->ready.front();
+                    installer->ready.pop_front();
+                }
+                if (!installAsset(*installer, index))
+                    installer->failed = true;
+            }
+        }
+
+        /// foo.zip.sha256 or a SHA256SUMS file, published next to the assets instead of being installed
+        bool isChecksumAsset(const AssetInfo& asset) {
+            std::string name = asset.filename;
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            return (name.size() > 7 && name.compare(name.size() - 7, 7, ".sha256") == 0) || name == "sha256sums" || name == "sha256sums.txt";
+        }
+
+        /// Fetches the checksum assets (tiny, all at once), moves their digests onto the assets they describe and drops them
+        /// from the list. Digests the API already gave are kept. Returns false if a published checksum couldn't be fetched
+        bool fetchChecksumAssets(const std::vector<std::string>& headers, AssetInfos& assets) {
+            AssetInfos checksums;
+            AssetInfos installable;
+            for (const AssetInfo& asset : assets)
+                (isChecksumAsset(asset) ? checksums : installable).push_back(asset);
+            std::vector<net::Request> requests;
+            for (const AssetInfo& checksum : checksums) {
+                net::Request request = { checksum.url.string(), headers };
+                request.follow_redirects = true;
+                requests.push_back(request);
+            }
+            if (!requests.empty())
+                net::performBatch(requests);
+            for (size_t i = 0; i < checksums.size(); i++) {
+                if (requests[i].result != CURLE_OK || requests[i].http_code != 200)
+                    return false;
+                const std::string& name = checksums[i].filename;
+                if (name.size() > 7 && name[name.size() - 7] == '.') { // foo.zip.sha256 only has to hold the digest of foo.zip
+                    std::string target = name.substr(0, name.size() - 7);
+                    for (AssetInfo& asset : installable)
+                        if (asset.filename == target && asset.sha256.empty())
+                            asset.sha256 = hash::findSha256(requests[i].body);
+                }
+                else
+                    applyPublishedDigests(requests[i].body, installable);
+            }
+            assets = installable;
+            return true;
+        }
+
+        /// Runs on the download's writer thread, so inflating and writing the entries never holds up the network
+        bool extractChunk(void* user_data, const char* data, size_t size) {
+            return ((zip::StreamExtractor*)user_data)->Feed(data, size);
+        }
+
+        /// Same for a .tar.zst, zstd decodes here and the files are written by the extractor's own writer thread
+        bool extractTarChunk(void* user_data, const char* data, size_t size) {
+            return ((tar::StreamExtractor*)user_data)->Feed(data, size);
+        }
+
+        /// Keeps a small zip in RAM, it is extracted from there once the download is complete and verified
+        bool collectChunk(void* user_data, const char* data, size_t size) {
+            ((std::string*)user_data)->append(data, size);
+            return true;
+        }
+
+        InstallStats install_stats = { 0, 0, "", 0, 0, "" };
+        InstallEstimate install_estimate = { 0, 0, 0, 0, 0, false };
+
+        std::vector<std::string> assetHeaders(OauthToken token) {
             std::vector<std::string> headers;
             if (token != nullptr) headers.push_back(makeAuthHeader(token));
             headers.push_back("Accept: application/octet-stream");
+            return headers;
+        }
 
-            for (size_t i = 0; i < assets.size(); i++) {
+        /// Free space on the SD card, unlimited when the card won't say so an install is never refused for nothing
+        uint64_t freeSpace() {
+            FsFileSystem* sd = fsdevGetDeviceFileSystem("sdmc");
+            s64 free = 0;
+            if (sd == nullptr || R_FAILED(fsFsGetFreeSpace(sd, "/", &free)))
+                return UINT64_MAX;
+            return free;
+        }
 
-                std::filesystem::path url = assets[i].url;
-
-                std::string path = filepath_root + url.filename().string();
-                FILE* file = fopen(path.c_str(), "wb"); // using C file IO because that is what CURL requires
-
-                if (assets.size() > 1)
-                    std::cout << "\nDownloading multiple files... " GREEN "(" << i+1 << "/" << assets.size() << ")\n" RESET;
-
-                CURLcode result =
-                    curl.SetHeaders(headers)
-                        .SetURL(url.c_str())
-                        .SetOPT(CURLOPT_WRITEDATA, file)
-                        .SetOPT(CURLOPT_USERAGENT, "HDR-User")
-                        .SetOPT(CURLOPT_FOLLOWLOCATION, 1L)
-                        .SetOPT(CURLOPT_SSL_VERIFYPEER, 0L)
-                        .SetOPT(CURLOPT_SSL_VERIFYHOST, 0L)
-                        .SetOPT(CURLOPT_NOPROGRESS, 0L)
-                        .SetOPT(CURLOPT_PROGRESSFUNCTION, download_progress)
-                        .Perform();
-                if (result != CURLE_OK) {
-                    fclose(file);
-                    if (std::filesystem::exists(path))
-                        std::filesystem::remove(path);
-                    return DownloadResult::DOWNLOAD_FAILED;
+        /// The zips are sized from their central directories, which are kept in directories (nullptr where one couldn't be
+        /// read), the other assets with the size the API gave
+        InstallEstimate estimateAssets(const std::vector<std::string>& headers, const AssetInfos& assets, zip::InstallIndex* index, std::vector<std::unique_ptr<zip::RemoteArchive>>& directories) {
+            InstallEstimate estimate = { 0, 0, 0, 0, freeSpace(), true };
+            std::vector<std::string> zip_urls;
+            std::vector<size_t> zip_assets;
+            for (size_t i = 0; i < assets.size(); i++)
+                if (assets[i].content_type == "application/zip" && !tar::isTarZst(assets[i].filename)) {
+                    zip_urls.push_back(assets[i].url.string());
+                    zip_assets.push_back(i);
                 }
-                fclose(file);
-                if (std::filesystem::exists(path) && assets[i].content_type == "application/zip") { // if it's a zip, extract to root then delete it
-                    std::cout << GREEN "\nExtracting...\n" RESET;
-                    consoleUpdate(NULL);
-                    //if (!std::filesystem::exists(TMP_EXTRACTED))
-                        //std::filesystem::create_directories(TMP_EXTRACTED);
-                    elz::extractZip(path, SYSTEM_ROOT/*TMP_EXTRACTED*/);
-                    consoleClear();
-                    std::filesystem::remove(path);
+            std::vector<std::unique_ptr<zip::RemoteArchive>> read;
+            zip::readRemoteDirectories(zip_urls, headers, read); // all at once, the install waits for the slowest one only
+            directories.clear();
+            directories.resize(assets.size());
+            for (size_t i = 0; i < zip_assets.size(); i++)
+                directories[zip_assets[i]] = std::move(read[i]);
+            for (size_t i = 0; i < assets.size(); i++) {
+                const AssetInfo& asset = assets[i];
+                estimate.download_bytes += asset.size;
+                if (tar::isTarZst(asset.filename)) { // no directory to read, what's inside is only known once it arrives
+                    estimate.complete = false;
+                    continue;
                 }
-                else { // otherwise, just rename the file to it's proper name instead of it's asset id
-                    std::filesystem::path new_path = filepath_root + assets[i].filename;
-                    rename(path.c_str(), new_path.c_str());
+                if (asset.content_type != "application/zip") {
+                    estimate.files++;
+                    estimate.install_bytes += asset.size;
+                    estimate.write_bytes += asset.size;
+                    continue;
+                }
+                if (!directories[i]) {
+                    estimate.complete = false;
+                    continue;
+                }
+                const zip::RemoteArchive& archive = *directories[i];
+                if (!settings.stream_extraction && archive.size > MEMORY_ASSET_SIZE)
+                    estimate.write_bytes += archive.size; // the zip itself sits on the card until it is extracted
+                for (const zip::EntryInfo& entry : archive.entries) {
+                    if (entry.name.empty() || entry.name.back() == '/')
+                        continue;
+                    estimate.files++;
+                    estimate.install_bytes += entry.size;
+                    if (index == nullptr || !index->Recorded(std::string(SYSTEM_ROOT) + entry.name, entry.crc, entry.size))
+                        estimate.write_bytes += entry.size; // the old file is only removed once every new one is complete
                 }
             }
-            ret = DownloadResult::SUCCESS;
-            END_BREAKABLE
+            return estimate;
         }
+
+        /// Updates the zips whose directories could be read by fetching only the entries that changed, and takes them off
+        /// the install list. Those are checked against the CRCs of the central directory since the digest of the whole zip
+        /// can't be, so a zip with a published SHA-256 is always downloaded whole. A zip where too much changed, or whose
+        /// server won't serve ranges, stays in the list to be downloaded
+        void rangeUpdate(const std::vector<std::string>& headers, AssetInfos& assets, const std::vector<std::unique_ptr<zip::RemoteArchive>>& directories, zip::InstallIndex& index, InstallStats& stats) {
+            AssetInfos remaining;
+            for (size_t i = 0; i < assets.size(); i++) {
+                if (!directories[i] || !assets[i].sha256.empty()) {
+                    remaining.push_back(assets[i]);
+                    continue;
+                }
+                std::cout << GREEN "\nFetching the changed files of " RESET << assets[i].filename << "\n";
+                consoleUpdate(NULL);
+                zip::RangeStats range_stats;
+                zip::RangeResult result = zip::fetchChangedEntries(assets[i].url.string(), headers, *directories[i], SYSTEM_ROOT, index, settings.max_parallel_downloads, &range_stats);
+                if (result != zip::RangeResult::INSTALLED) { // nothing was touched, the full zip fixes whatever went wrong
+                    remaining.push_back(assets[i]);
+                    continue;
+                }
+                stats.written += range_stats.changed;
+                stats.skipped += range_stats.unchanged;
+                stats.ranged_bytes += range_stats.bytes;
+                stats.ranged_archive_bytes += directories[i]->size;
+            }
+            assets = remaining;
+        }
+
+        /// Tag of the release the files on the card came from, empty if it's another repository or an install didn't finish
+        std::string installedTag(const std::string& repository) {
+            std::ifstream file(std::string(APP_PATH) + INSTALLED_RELEASE_FILE, std::ios_base::in);
+            if (!file.is_open())
+                return "";
+            json installed;
+            try { installed = json::parse(file); }
+            catch (json::parse_error& e) { return ""; }
+            if (!installed.is_object() || !installed["repository"].is_string() || installed["repository"] != repository || !installed["tag"].is_string())
+                return ""; // a damaged record only costs the patch, the full zips still install
+            return installed["tag"].get<std::string>();
+        }
+
+        void saveInstalledTag(const std::string& repository, const std::string& tag) {
+            std::ofstream file(std::string(APP_PATH) + INSTALLED_RELEASE_FILE, std::ios_base::out | std::ios_base::trunc);
+            file << json({ { "repository", repository }, { "tag", tag } }).dump();
+        }
+
+        /// Takes the patch assets out of the install list. If one was made against the installed tag it is downloaded and
+        /// applied, and the archives it rebuilt are dropped as well. Returns false when the full archives are still needed
+        bool patchRelease(const std::vector<std::string>& headers, AssetInfos& assets, const std::string& installed_tag, const std::string& filepath_root, zip::InstallIndex* index, patch::PatchStats& stats, bool& cancelled) {
+            AssetInfos installable;
+            AssetInfos patches;
+            for (const AssetInfo& asset : assets)
+                if (!patch::isPatchAsset(asset.filename))
+                    installable.push_back(asset);
+                else if (!installed_tag.empty() && asset.filename == patch::assetName(installed_tag))
+                    patches.push_back(asset);
+            assets = installable;
+            cancelled = false;
+            stats = { 0, 0, 0 };
+            if (patches.empty() || !settings.patch_updates)
+                return false;
+
+            std::filesystem::path url = patches[0].url;
+            std::vector<net::Download> downloads = { { url.string(), headers, filepath_root + url.filename().string(), 1, settings.preallocate_downloads, patches[0].sha256 } };
+            std::string body;
+            if (patches[0].size <= MEMORY_ASSET_SIZE) {
+                body.reserve(patches[0].size);
+                downloads[0].path.clear();
+                downloads[0].sink = collectChunk;
+                downloads[0].sink_data = &body;
+            }
+            bool patched = net::downloadAll(downloads, 1, download_progress, nullptr, nullptr);
+            cancelled = downloads[0].result == CURLE_ABORTED_BY_CALLBACK;
+            if (patched) {
+                std::cout << GREEN "\nPatching...\n" RESET;
+                consoleUpdate(NULL);
+                zip::MemoryArchive archive = { body.data(), body.size() };
+                zlib_filefunc64_def io;
+                if (downloads[0].sink != nullptr)
+                    zip::fillMemoryFileFunctions(&io, &archive);
+                else
+                    zip::fillBufferedFileFunctions(&io);
+                std::string name = downloads[0].sink != nullptr ? patches[0].filename : downloads[0].path;
+                patched = patch::applyPatch(name, SYSTEM_ROOT, index, &stats, nullptr, &io); // the checksums reject files that aren't the installed tag's
+            }
+            std::error_code error;
+            if (!downloads[0].path.empty()) {
+                std::filesystem::remove(downloads[0].path, error);
+                std::filesystem::remove(downloads[0].path + net::PARTIAL_SUFFIX, error);
+            }
+            if (!patched) {
+                stats = { 0, 0, 0 };
+                return false;
+            }
+            assets.erase(std::remove_if(assets.begin(), assets.end(), [](const AssetInfo& asset) { return asset.content_type == "application/zip" || tar::isTarZst(asset.filename); }), assets.end());
+            return true;
+        }
+
+        void onAssetDownloaded(void* user_data, net::Download& download) {
+            Installer* installer = (Installer*)user_data;
+            std::lock_guard<std::mutex> guard(installer->lock);
+            installer->ready.push_back(&download - installer->downloads->data());
+            installer->wake.notify_one();
+        }
+    }
+
+    InstallStats getInstallStats() {
+        return install_stats;
+    }
+
+    bool getAssetEntries(OauthToken token, const AssetInfo& asset, zip::RemoteArchive& archive, std::string* error) {
+        return zip::readRemoteDirectory(asset.url.string(), assetHeaders(token), archive, error);
+    }
+
+    InstallEstimate estimateInstall(OauthToken token, const std::string& repository, const std::string& tag) {
+        AssetInfos assets = getReleaseInfos(token, repository, tag);
+        assets.erase(std::remove_if(assets.begin(), assets.end(), [](const AssetInfo& asset) { return isChecksumAsset(asset) || patch::isPatchAsset(asset.filename); }), assets.end());
+        std::unique_ptr<zip::InstallIndex> index;
+        if (settings.incremental_install)
+            index.reset(new zip::InstallIndex(std::string(APP_PATH) + INSTALL_INDEX_FILE));
+        std::vector<std::unique_ptr<zip::RemoteArchive>> directories;
+        InstallEstimate estimate = estimateAssets(assetHeaders(token), assets, index.get(), directories);
+        estimate.complete = estimate.complete && !assets.empty();
+        return estimate;
+    }
+
+    InstallEstimate getInstallEstimate() {
+        return install_estimate;
+    }
+
+    DownloadResult downloadRelease(OauthToken token, const std::string& repository, const std::string& tag, const std::string& filepath_root) {
+        DownloadResult ret = DownloadResult::CURL_ERROR;
+        if (!userHasPermissions(token, repository, GithubPermissions::PULL))
+            return ret;
+        START_BREAKABLE
+        AssetInfos assets = getReleaseInfos(token, repository, tag);
+        if (assets.size() < 1) {
+            invalidatePermissions(token, repository); // access may have been revoked, check again next time
+            ret = DownloadResult::DOES_NOT_EXIST;
+            break;
+        }
+
+        std::vector<std::string> headers = assetHeaders(token);
+        if (!fetchChecksumAssets(headers, assets)) {
+            ret = DownloadResult::DOWNLOAD_FAILED;
+            break;
+        }
+
+        std::unique_ptr<zip::InstallIndex> index;
+        if (settings.incremental_install)
+            index.reset(new zip::InstallIndex(std::string(APP_PATH) + INSTALL_INDEX_FILE));
+        std::string installed_tag = installedTag(repository);
+        saveInstalledTag(repository, ""); // until this install is through the card holds neither release
+        patch::PatchStats patch_stats;
+        bool cancelled;
+        bool patched = patchRelease(headers, assets, installed_tag != tag ? installed_tag : "", filepath_root, index.get(), patch_stats, cancelled);
+        if (cancelled) {
+            ret = DownloadResult::DOWNLOAD_FAILED;
+            break;
+        }
+        std::vector<std::unique_ptr<zip::RemoteArchive>> directories;
+        install_estimate = estimateAssets(headers, assets, index.get(), directories);
+        std::cout << "Install size: " << install_estimate.install_bytes / (1024 * 1024) << " MiB in " << install_estimate.files << " files, "
+                  << install_estimate.download_bytes / (1024 * 1024) << " MiB to download\n";
+        consoleUpdate(NULL);
+        if (install_estimate.write_bytes > install_estimate.free_bytes) {
+            if (!patched)
+                saveInstalledTag(repository, installed_tag); // nothing was touched
+            ret = DownloadResult::NOT_ENOUGH_SPACE;
+            break;
+        }
+        InstallStats range_stats = { 0, 0, "", 0, 0, "" };
+        if (index && settings.range_updates)
+            rangeUpdate(headers, assets, directories, *index, range_stats);
+        std::vector<net::Download> downloads;
+        std::vector<std::unique_ptr<zip::StreamExtractor>> extractors(assets.size()); // destroyed last, removing whatever wasn't committed
+        std::vector<std::unique_ptr<tar::StreamExtractor>> tar_extractors(assets.size());
+        std::vector<std::unique_ptr<std::string>> bodies(assets.size());
+        for (size_t i = 0; i < assets.size(); i++) {
+            std::filesystem::path url = assets[i].url;
+            size_t segments = assets[i].size >= 2 * net::SEGMENT_MIN_SIZE ? settings.download_segments : 1; // small assets aren't worth the range probe
+            downloads.push_back({ url.string(), headers, filepath_root + url.filename().string(), segments, settings.preallocate_downloads, assets[i].sha256 });
+            if (settings.stream_extraction && assets[i].content_type == "application/zip") { // no zip on the card, the entries go straight to their place
+                extractors[i].reset(new zip::StreamExtractor(SYSTEM_ROOT, index.get()));
+                downloads.back().path.clear();
+                downloads.back().sink = extractChunk;
+                downloads.back().sink_data = extractors[i].get();
+            }
+            else if (settings.stream_extraction && tar::isTarZst(assets[i].filename)) {
+                tar_extractors[i].reset(new tar::StreamExtractor(SYSTEM_ROOT, index.get()));
+                downloads.back().path.clear();
+                downloads.back().sink = extractTarChunk;
+                downloads.back().sink_data = tar_extractors[i].get();
+            }
+            else if (assets[i].content_type == "application/zip" && assets[i].size <= MEMORY_ASSET_SIZE) { // small enough to skip the card
+                bodies[i].reset(new std::string);
+                bodies[i]->reserve(assets[i].size);
+                downloads.back().path.clear();
+                downloads.back().sink = collectChunk;
+                downloads.back().sink_data = bodies[i].get();
+            }
+        }
+
+        Installer installer;
+        installer.assets = &assets;
+        installer.downloads = &downloads;
+        installer.extractors = &extractors;
+        installer.tar_extractors = &tar_extractors;
+        installer.bodies = &bodies;
+        installer.filepath_root = filepath_root;
+        installer.index = index.get();
+        installer.closed = false;
+        installer.failed = false;
+        installer.stats = { patch_stats.patched + patch_stats.added + range_stats.written, range_stats.skipped, patched ? installed_tag : "", range_stats.ranged_bytes, range_stats.ranged_archive_bytes, "" };
+        std::thread installer_thread(installerThread, &installer);
+
+        bool downloaded = net::downloadAll(downloads, settings.max_parallel_downloads, download_progress, onAssetDownloaded, &installer);
+        {
+            std::lock_guard<std::mutex> guard(installer.lock);
+            installer.closed = true;
+            installer.wake.notify_one();
+        }
+        std::cout << GREEN "\nExtracting...\n" RESET;
+        consoleUpdate(NULL);
+        installer_thread.join(); // whatever finished downloading still gets installed
+        consoleClear();
+        for (size_t i = 0; i < downloads.size(); i++) { // the sink stopped the transfer, the network was fine
+            if (!downloads[i].sink_failed)
+                continue;
+            if (extractors[i])
+                extractionFailed(installer, assets[i], extractors[i]->Error());
+            else if (tar_extractors[i])
+                extractionFailed(installer, assets[i], tar_extractors[i]->Error());
+            installer.failed = true;
+        }
+        install_stats = installer.stats;
+        if (index)
+            index->Save(); // also after a failure, the files that did get written are in it
+        for (const net::Download& download : downloads)
+            if (download.corrupt)
+                return DownloadResult::VERIFICATION_FAILED;
+        if (installer.failed)
+            return DownloadResult::EXTRACTION_FAILED;
+        if (!downloaded)
+            return DownloadResult::DOWNLOAD_FAILED;
+        saveInstalledTag(repository, tag);
+        ret = DownloadResult::SUCCESS;
+        END_BREAKABLE
         return ret;
     }
 }
 
+Settings settings = { 3, 4, true, true, zip::APPLICATION_CORES, true, true, true, "" };
+
+namespace { // settings detail stuff
+    /// A key that is missing or holds the wrong type (a string for a number, null) keeps its default instead of throwing
+    bool readSetting(const json& parsed, const char* key, bool fallback) {
+        json::const_iterator value = parsed.find(key);
+        return value != parsed.end() && value->is_boolean() ? value->get<bool>() : fallback;
+    }
+
+    int readSetting(const json& parsed, const char* key, int fallback) {
+        json::const_iterator value = parsed.find(key);
+        return value != parsed.end() && value->is_number_integer() ? value->get<int>() : fallback;
+    }
+
+    std::string readSetting(const json& parsed, const char* key, const std::string& fallback) {
+        json::const_iterator value = parsed.find(key);
+        return value != parsed.end() && value->is_string() ? value->get<std::string>() : fallback;
+    }
+}
+
+void loadSettings() {
+    std::stringstream buffer;
+    buffer << APP_PATH << SETTINGS_FILE;
+    std::ifstream file(buffer.str(), std::ios_base::in);
+    if (!file.is_open())
+        return;
+    json parsed;
+    try { parsed = json::parse(file); }
+    catch (json::parse_error& e) { return; }
+    if (!parsed.is_object())
+        return;
+    settings.max_parallel_downloads = std::max(1, readSetting(parsed, "max_parallel_downloads", (int)settings.max_parallel_downloads));
+    settings.download_segments = std::max(1, readSetting(parsed, "download_segments", (int)settings.download_segments));
+    settings.preallocate_downloads = readSetting(parsed, "preallocate_downloads", settings.preallocate_downloads);
+    settings.stream_extraction = readSetting(parsed, "stream_extraction", settings.stream_extraction);
+    settings.extract_threads = std::clamp(readSetting(parsed, "extract_threads", (int)settings.extract_threads), 1, (int)zip::APPLICATION_CORES);
+    settings.incremental_install = readSetting(parsed, "incremental_install", settings.incremental_install);
+    settings.patch_updates = readSetting(parsed, "patch_updates", settings.patch_updates);
+    settings.range_updates = readSetting(parsed, "range_updates", settings.range_updates);
+#ifdef API_FIXTURE
+    settings.api_root = readSetting(parsed, "api_root", settings.api_root);
+    if (!settings.api_root.empty())
+        gh::setApiRoot(settings.api_root);
+#endif
+}
+
 gh::OauthToken loadOauthToken() {
     gh::OauthToken ret = nullptr;
     std::stringstream buffer;
@@ -387,6 +1200,7 @@ void prep() {
         if (!std::filesystem::exists(dir))
             std::filesystem::create_directories(dir);
     }
+    loadSettings();
 
     /*
     if (!std::filesystem::exists(INSTALLED_MODS)) { // installed mods file doesn't exist
@@ -0,0 +1,111 @@
+#include "write_behind.hpp"
+
+#include <chrono>
+#include <unistd.h>
+
+namespace net {
+
+    namespace { // write behind detail stuff
+        typedef std::chrono::steady_clock clock;
+
+        uint64_t millisecondsSince(clock::time_point start) {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count();
+        }
+    }
+
+    bool preallocate(FILE* file, int64_t size) {
+        return fflush(file) == 0 && ftruncate(fileno(file), size) == 0;
+    }
+
+    WriteBehind::WriteBehind(size_t queue_capacity, size_t buffer_size)
+        : m_BufferSize(buffer_size), m_QueueCapacity(queue_capacity < 1 ? 1 : queue_capacity), m_Busy(false), m_Closing(false) {
+        m_Stats = { 0, 0, 0, m_QueueCapacity, 0, 0, 0 };
+        m_Thread = std::thread(&WriteBehind::Run, this);
+    }
+
+    WriteBehind::~WriteBehind() {
+        {
+            std::lock_guard<std::mutex> guard(m_Lock);
+            m_Closing = true;
+            m_Work.notify_one();
+        }
+        m_Thread.join();
+    }
+
+    void WriteBehind::Run() {
+        std::unique_lock<std::mutex> guard(m_Lock);
+        while (true) {
+            clock::time_point idle_start = clock::now();
+            m_Work.wait(guard, [this] { return !m_Queue.empty() || m_Closing; });
+            if (m_Queue.empty()) // closing and nothing left to write
+                break;
+            m_Stats.idle_ms += millisecondsSince(idle_start);
+            Job job = m_Queue.front();
+            m_Queue.pop_front();
+            m_Busy = true;
+            guard.unlock();
+
+            clock::time_point write_start = clock::now();
+            bool ok = job.file == nullptr || (fseeko(job.file, job.offset, SEEK_SET) == 0 && fwrite(job.buffer, 1, job.size, job.file) == job.size);
+            uint64_t write_ms = millisecondsSince(write_start);
+            if (ok && job.on_written != nullptr)
+                ok = job.on_written(job.user_data, job.buffer, job.size);
+
+            guard.lock();
+            if (!ok)
+                *job.failed = true;
+            if (job.file != nullptr) { // bytes that only went to on_written never reached the card
+                m_Stats.bytes += job.size;
+                m_Stats.writes++;
+                m_Stats.write_ms += write_ms;
+            }
+            m_Free.push_back(job.buffer);
+            m_Busy = false;
+            m_Space.notify_all();
+        }
+    }
+
+    char* WriteBehind::Acquire() {
+        std::unique_lock<std::mutex> guard(m_Lock);
+        if (m_Queue.size() >= m_QueueCapacity) {
+            clock::time_point stall_start = clock::now();
+            m_Space.wait(guard, [this] { return m_Queue.size() < m_QueueCapacity; });
+            m_Stats.stall_ms += millisecondsSince(stall_start);
+        }
+        if (!m_Free.empty()) {
+            char* buffer = m_Free.back();
+            m_Free.pop_back();
+            return buffer;
+        }
+        // one buffer per producer plus the queue, allocated on first use and kept until the writer goes away
+        m_Buffers.emplace_back(new char[m_BufferSize]);
+        return m_Buffers.back().get();
+    }
+
+    void WriteBehind::Submit(FILE* file, int64_t offset, char* buffer, size_t size, bool* failed, WrittenCallback on_written, void* user_data) {
+        std::lock_guard<std::mutex> guard(m_Lock);
+        m_Queue.push_back({ file, offset, buffer, size, failed, on_written, user_data });
+        if (m_Queue.size() > m_Stats.max_queue_depth)
+            m_Stats.max_queue_depth = m_Queue.size();
+        m_Work.notify_one();
+    }
+
+    void WriteBehind::Release(char* buffer) {
+        std::lock_guard<std::mutex> guard(m_Lock);
+        m_Free.push_back(buffer);
+    }
+
+    void WriteBehind::Sync() {
+        std::unique_lock<std::mutex> guard(m_Lock);
+        if (m_Queue.empty() && !m_Busy)
+            return;
+        clock::time_point stall_start = clock::now();
+        m_Space.wait(guard, [this] { return m_Queue.empty() && !m_Busy; });
+        m_Stats.stall_ms += millisecondsSince(stall_start);
+    }
+
+    WriteStats WriteBehind::Stats() {
+        std::lock_guard<std::mutex> guard(m_Lock);
+        return m_Stats;
+    }
+}
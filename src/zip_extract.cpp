@@ -0,0 +1,216 @@
+#include "zip_extract.hpp"
+#include "zip_stream.hpp"
+
+#ifdef __SWITCH__
+#include <switch.h>
+#endif
+#include <minizip/unzip.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace zip {
+
+    namespace { // parallel extraction detail stuff
+        typedef std::chrono::steady_clock clock;
+
+        static constexpr size_t MAX_NAME_LENGTH = 1024;
+
+        struct Job {
+            std::string name;
+            unz64_file_pos position;    // lets a worker jump straight to the entry in its own handle
+            uint64_t compressed_size;
+            uint64_t size;
+            uint32_t crc;
+        };
+
+        /// What the workers share, next is the only thing they contend on
+        struct Work {
+            const std::string* archive;
+            const std::string* root;
+            const std::vector<Job>* jobs;
+            InstallIndex* index;
+            const zlib_filefunc64_def* io;
+            std::atomic<size_t> next;
+            std::atomic<bool> failed;
+            std::atomic<size_t> entries;
+            std::atomic<size_t> skipped;
+            std::atomic<uint64_t> bytes;
+            std::mutex error_lock;
+            std::string error;
+        };
+
+        uint64_t millisecondsSince(clock::time_point start) {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count();
+        }
+
+        /// With io nullptr minizip's own stdio functions are used. It keeps a copy of the functions, so one def serves every open
+        unzFile openArchive(const std::string& archive, const zlib_filefunc64_def* io) {
+            if (io == nullptr)
+                return unzOpen64(archive.c_str());
+            zlib_filefunc64_def functions = *io;
+            return unzOpen2_64(archive.c_str(), &functions);
+        }
+
+        void fail(Work& work, const std::string& error) {
+            std::lock_guard<std::mutex> guard(work.error_lock);
+            if (!work.failed.exchange(true))
+                work.error = error;
+        }
+
+        bool extractEntry(unzFile archive, const Job& job, const std::string& root, char* buffer, std::string& error) {
+            if (unzGoToFilePos64(archive, &job.position) != UNZ_OK || unzOpenCurrentFile(archive) != UNZ_OK) {
+                error = "Couldn't open " + job.name + " in the archive";
+                return false;
+            }
+            std::string path = root + job.name;
+            FILE* file = fopen(path.c_str(), "wb");
+            if (file == nullptr) {
+                unzCloseCurrentFile(archive);
+                error = "Couldn't create " + path;
+                return false;
+            }
+            int read;
+            bool written = true;
+            while ((read = unzReadCurrentFile(archive, buffer, OUTPUT_CHUNK_SIZE)) > 0 && written)
+                written = fwrite(buffer, 1, read, file) == (size_t)read;
+            written = fclose(file) == 0 && written;
+            int closed = unzCloseCurrentFile(archive); // checks the CRC once the whole entry was read
+            if (!written)
+                error = "Couldn't write " + path + ", is the card full?";
+            else if (read < 0 || closed != UNZ_OK)
+                error = job.name + " is corrupt";
+            return written && read == 0 && closed == UNZ_OK;
+        }
+
+        void worker(Work* work, size_t index) {
+#ifdef __SWITCH__
+            // libnx starts every thread on the default core, spread them out or they just take turns on it. Worker 0 is
+            // the calling thread, it stays where it is
+            if (index > 0)
+                svcSetThreadCoreMask(threadGetCurHandle(), index % APPLICATION_CORES, 1 << (index % APPLICATION_CORES));
+#endif
+            unzFile archive = openArchive(*work->archive, work->io);
+            if (archive == nullptr) {
+                fail(*work, "Couldn't open " + *work->archive);
+                return;
+            }
+            std::unique_ptr<char[]> buffer(new char[OUTPUT_CHUNK_SIZE]);
+            size_t next;
+            while (!work->failed && (next = work->next++) < work->jobs->size()) {
+                const Job& job = (*work->jobs)[next];
+                std::string path = *work->root + job.name;
+                if (work->index != nullptr && work->index->Unchanged(path, job.crc, job.size)) { // checked here so any hashing is spread too
+                    work->skipped++;
+                    continue;
+                }
+                std::string error;
+                if (!extractEntry(archive, job, *work->root, buffer.get(), error)) {
+                    fail(*work, error);
+                    break;
+                }
+                if (work->index != nullptr)
+                    work->index->Record(path, job.crc, job.size);
+                work->entries++;
+                work->bytes += job.size;
+            }
+            unzClose(archive);
+        }
+
+        /// Reads the central directory into jobs, folders collects every directory the files need
+        bool listEntries(const std::string& archive, const zlib_filefunc64_def* io, const std::string& base, std::vector<Job>& jobs, std::set<std::string>& folders, std::string& error) {
+            unzFile listing = openArchive(archive, io);
+            if (listing == nullptr) {
+                error = "Couldn't open " + archive;
+                return false;
+            }
+            char name[MAX_NAME_LENGTH];
+            int result = unzGoToFirstFile(listing);
+            while (result == UNZ_OK) {
+                unz_file_info64 info;
+                Job job;
+                if (unzGetCurrentFileInfo64(listing, &info, name, sizeof(name), nullptr, 0, nullptr, 0) != UNZ_OK || unzGetFilePos64(listing, &job.position) != UNZ_OK)
+                    break;
+                job.name = name;
+                job.compressed_size = info.compressed_size;
+                job.size = info.uncompressed_size;
+                job.crc = info.crc;
+                if (!safeEntryName(job.name)) {
+                    error = job.name + " points outside the install folder";
+                    unzClose(listing);
+                    return false;
+                }
+                if (job.name.back() == '/')
+                    folders.insert(base + job.name);
+                else {
+                    folders.insert(std::filesystem::path(base + job.name).parent_path().string());
+                    jobs.push_back(job);
+                }
+                result = unzGoToNextFile(listing);
+            }
+            unzClose(listing);
+            if (result != UNZ_END_OF_LIST_OF_FILE) {
+                error = archive + " is not a valid zip";
+                return false;
+            }
+            return true;
+        }
+    }
+
+    bool extractParallel(const std::string& archive, const std::string& root, size_t threads, ExtractStats* stats, std::string* error, InstallIndex* index, const zlib_filefunc64_def* io) {
+        clock::time_point start = clock::now();
+        std::string base = root;
+        if (!base.empty() && base.back() != '/')
+            base += '/';
+        std::vector<Job> jobs;
+        std::set<std::string> folders;
+        std::string message;
+        if (!listEntries(archive, io, base, jobs, folders, message)) {
+            if (error != nullptr)
+                *error = message;
+            return false;
+        }
+        for (const std::string& folder : folders) { // up front, workers creating the same folder at once would race
+            std::error_code ignored;
+            std::filesystem::create_directories(folder, ignored);
+        }
+        // largest first so none is left running at the end, the small ones stay in archive order where a read-ahead
+        // brings the next few along with them
+        std::vector<Job>::iterator small = std::stable_partition(jobs.begin(), jobs.end(), [](const Job& job) { return job.compressed_size >= READ_AHEAD_SIZE; });
+        std::stable_sort(jobs.begin(), small, [](const Job& a, const Job& b) { return a.compressed_size > b.compressed_size; });
+        uint64_t list_ms = millisecondsSince(start);
+
+        start = clock::now();
+        threads = std::max<size_t>(1, std::min(threads, jobs.size()));
+        Work work;
+        work.archive = &archive;
+        work.root = &base;
+        work.jobs = &jobs;
+        work.index = index;
+        work.io = io;
+        work.next = 0;
+        work.failed = false;
+        work.entries = 0;
+        work.skipped = 0;
+        work.bytes = 0;
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < threads; i++)
+            workers.emplace_back(worker, &work, i);
+        worker(&work, 0); // the calling thread does its share instead of just waiting
+        for (std::thread& thread : workers)
+            thread.join();
+
+        if (stats != nullptr)
+            *stats = { threads, work.entries, work.skipped, work.bytes, list_ms, millisecondsSince(start) };
+        if (work.failed && error != nullptr)
+            *error = work.error;
+        return !work.failed;
+    }
+}
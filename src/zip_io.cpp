@@ -0,0 +1,155 @@
+#include "zip_io.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace zip {
+
+    namespace { // zip io detail stuff
+        struct BufferedFile {
+            FILE* file;
+            std::unique_ptr<char[]> buffer;
+            uint64_t buffer_offset; // where buffer[0] is in the file
+            size_t buffered;        // valid bytes in the buffer
+            size_t window;          // what the next refill reads
+            uint64_t position;      // where minizip thinks it is, the file's own position only matters when reading
+            uint64_t size;
+            bool error;
+        };
+
+        struct MemoryFile {
+            const MemoryArchive* archive;
+            uint64_t position;
+        };
+
+        /// The offset a seek lands on, past the end is fine, reads there just return nothing
+        bool seekTarget(uint64_t position, uint64_t size, ZPOS64_T offset, int origin, uint64_t& target) {
+            switch (origin) {
+                case ZLIB_FILEFUNC_SEEK_SET: target = offset; return true;
+                case ZLIB_FILEFUNC_SEEK_CUR: target = position + offset; return true; // offset wraps for negative moves
+                case ZLIB_FILEFUNC_SEEK_END: target = size + offset; return true;
+                default: return false;
+            }
+        }
+
+        voidpf openBuffered(voidpf opaque, const void* filename, int mode) {
+            if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ || filename == nullptr)
+                return nullptr;
+            FILE* file = fopen((const char*)filename, "rb");
+            if (file == nullptr)
+                return nullptr;
+            setvbuf(file, nullptr, _IONBF, 0); // the read-ahead buffer replaces stdio's
+            off_t size;
+            if (fseeko(file, 0, SEEK_END) != 0 || (size = ftello(file)) < 0) {
+                fclose(file);
+                return nullptr;
+            }
+            return new BufferedFile{ file, std::unique_ptr<char[]>(new char[READ_AHEAD_SIZE]), 0, 0, READ_AHEAD_MIN, 0, (uint64_t)size, false };
+        }
+
+        uLong readBuffered(voidpf opaque, voidpf stream, void* buf, uLong size) {
+            BufferedFile* file = (BufferedFile*)stream;
+            char* out = (char*)buf;
+            size_t copied = 0;
+            while (copied < size && file->position < file->size) {
+                if (file->position >= file->buffer_offset && file->position < file->buffer_offset + file->buffered) {
+                    size_t at = file->position - file->buffer_offset;
+                    size_t length = std::min<size_t>(size - copied, file->buffered - at);
+                    memcpy(out + copied, file->buffer.get() + at, length);
+                    copied += length;
+                    file->position += length;
+                    continue;
+                }
+                bool sequential = file->buffered > 0 && file->position == file->buffer_offset + file->buffered;
+                file->window = sequential ? std::min(file->window * 2, READ_AHEAD_SIZE) : READ_AHEAD_MIN;
+                bool direct = size - copied >= file->window; // the buffer would only be copied out again
+                if (fseeko(file->file, file->position, SEEK_SET) != 0) {
+                    file->error = true;
+                    break;
+                }
+                size_t read = direct ? fread(out + copied, 1, size - copied, file->file) : fread(file->buffer.get(), 1, file->window, file->file);
+                if (read == 0) {
+                    file->error = ferror(file->file) != 0;
+                    break;
+                }
+                if (direct) {
+                    copied += read;
+                    file->position += read;
+                }
+                else {
+                    file->buffer_offset = file->position;
+                    file->buffered = read;
+                }
+            }
+            return copied;
+        }
+
+        uLong writeNothing(voidpf opaque, voidpf stream, const void* buf, uLong size) {
+            return 0;
+        }
+
+        ZPOS64_T tellBuffered(voidpf opaque, voidpf stream) {
+            return ((BufferedFile*)stream)->position;
+        }
+
+        long seekBuffered(voidpf opaque, voidpf stream, ZPOS64_T offset, int origin) {
+            BufferedFile* file = (BufferedFile*)stream;
+            return seekTarget(file->position, file->size, offset, origin, file->position) ? 0 : -1;
+        }
+
+        int closeBuffered(voidpf opaque, voidpf stream) {
+            BufferedFile* file = (BufferedFile*)stream;
+            int result = fclose(file->file);
+            delete file;
+            return result;
+        }
+
+        int errorBuffered(voidpf opaque, voidpf stream) {
+            return ((BufferedFile*)stream)->error ? 1 : 0;
+        }
+
+        voidpf openMemory(voidpf opaque, const void* filename, int mode) {
+            if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ || opaque == nullptr)
+                return nullptr;
+            return new MemoryFile{ (const MemoryArchive*)opaque, 0 };
+        }
+
+        uLong readMemory(voidpf opaque, voidpf stream, void* buf, uLong size) {
+            MemoryFile* file = (MemoryFile*)stream;
+            if (file->position >= file->archive->size)
+                return 0;
+            size_t length = std::min<uint64_t>(size, file->archive->size - file->position);
+            memcpy(buf, file->archive->data + file->position, length);
+            file->position += length;
+            return length;
+        }
+
+        ZPOS64_T tellMemory(voidpf opaque, voidpf stream) {
+            return ((MemoryFile*)stream)->position;
+        }
+
+        long seekMemory(voidpf opaque, voidpf stream, ZPOS64_T offset, int origin) {
+            MemoryFile* file = (MemoryFile*)stream;
+            return seekTarget(file->position, file->archive->size, offset, origin, file->position) ? 0 : -1;
+        }
+
+        int closeMemory(voidpf opaque, voidpf stream) {
+            delete (MemoryFile*)stream;
+            return 0;
+        }
+
+        int errorMemory(voidpf opaque, voidpf stream) {
+            return 0;
+        }
+    }
+
+    void fillBufferedFileFunctions(zlib_filefunc64_def* functions) {
+        *functions = { openBuffered, readBuffered, writeNothing, tellBuffered, seekBuffered, closeBuffered, errorBuffered, nullptr };
+    }
+
+    void fillMemoryFileFunctions(zlib_filefunc64_def* functions, const MemoryArchive* archive) {
+        *functions = { openMemory, readMemory, writeNothing, tellMemory, seekMemory, closeMemory, errorMemory, (voidpf)archive };
+    }
+}
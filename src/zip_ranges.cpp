@@ -0,0 +1,337 @@
+#include "zip_ranges.hpp"
+#include "hash.hpp"
+#include "net.hpp"
+#include "zip_format.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <memory>
+
+namespace zip {
+
+    namespace { // zip ranges detail stuff
+        using namespace format;
+
+        /// Where a range of the archive sits in a response body
+        struct Part {
+            uint64_t first;
+            uint64_t last;
+            size_t at;
+        };
+
+        struct Pending {
+            std::string pending;
+            std::string path;
+            uint32_t crc;
+            uint64_t size;
+        };
+
+        std::string rangeHeader(const std::vector<ByteRange>& ranges) {
+            std::string header;
+            for (const ByteRange& range : ranges)
+                header += (header.empty() ? "" : ",") + std::to_string(range.first) + "-" + std::to_string(range.last);
+            return header;
+        }
+
+        uint64_t rangeBytes(const std::vector<ByteRange>& ranges) {
+            uint64_t bytes = 0;
+            for (const ByteRange& range : ranges)
+                bytes += range.last - range.first + 1;
+            return bytes;
+        }
+
+        /// boundary parameter of a multipart Content-Type, without quotes
+        std::string findBoundary(const std::string& content_type) {
+            size_t at = content_type.find("boundary=");
+            if (at == std::string::npos)
+                return "";
+            std::string boundary = content_type.substr(at + 9);
+            size_t end = boundary.find(';');
+            if (end != std::string::npos)
+                boundary.erase(end);
+            if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"')
+                boundary = boundary.substr(1, boundary.size() - 2);
+            return boundary;
+        }
+
+        /// Splits a multipart/byteranges body. Every part is as long as its Content-Range says, so entry data that happens
+        /// to contain the boundary can't cut it short
+        bool parseMultipart(const std::string& body, const std::string& boundary, uint64_t total, std::vector<Part>& parts) {
+            std::string delimiter = "--" + boundary;
+            size_t at = body.find(delimiter);
+            while (at != std::string::npos) {
+                at += delimiter.size();
+                if (body.compare(at, 2, "--") == 0) // closing delimiter
+                    return !parts.empty();
+                size_t headers_end = body.find("\r\n\r\n", at);
+                if (headers_end == std::string::npos)
+                    return false;
+                std::string headers = body.substr(at, headers_end - at + 2);
+                std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+                size_t range_at = headers.find("content-range:");
+                if (range_at == std::string::npos)
+                    return false;
+                size_t value = headers.find_first_not_of(" \t", range_at + 14);
+                uint64_t first, last, part_total;
+                if (value == std::string::npos || !net::parseContentRange(headers.substr(value, headers.find("\r\n", value) - value), first, last, part_total) || part_total != total)
+                    return false;
+                size_t data = headers_end + 4;
+                if (data + (last - first + 1) > body.size())
+                    return false;
+                parts.push_back({ first, last, data });
+                at = body.find(delimiter, data + (last - first + 1));
+            }
+            return false; // no closing delimiter, the body was cut short
+        }
+
+        /// A 206 with one range or with several in a multipart body
+        bool splitResponse(const net::Request& request, uint64_t total, std::vector<Part>& parts) {
+            if (request.result != CURLE_OK || request.http_code != 206)
+                return false;
+            if (request.content_type.rfind("multipart/byteranges", 0) == 0)
+                return parseMultipart(request.body, findBoundary(request.content_type), total, parts);
+            uint64_t first, last, part_total;
+            if (!net::parseContentRange(request.content_range, first, last, part_total) || part_total != total || request.body.size() != last - first + 1)
+                return false;
+            parts.push_back({ first, last, 0 });
+            return true;
+        }
+
+        bool writeOutput(FILE* file, const char* data, size_t size, uint32_t& crc, uint64_t& written) {
+            crc = hash::crc32(crc, data, size);
+            written += size;
+            return fwrite(data, 1, size, file) == size;
+        }
+
+        /// Writes the entry whose local header is at data[at] to pending, end is where the fetched bytes stop
+        bool extractEntry(const EntryInfo& entry, const std::string& data, size_t at, size_t end, const std::string& pending, std::string& error) {
+            if (at + LOCAL_HEADER_SIZE > end || read32(data, at) != LOCAL_SIGNATURE) {
+                error = entry.name + " isn't where the central directory says";
+                return false;
+            }
+            uint16_t flags = read16(data, at + 6);
+            uint16_t method = read16(data, at + 8);
+            size_t name_length = read16(data, at + 26);
+            size_t start = at + LOCAL_HEADER_SIZE + name_length + read16(data, at + 28);
+            if (name_length != entry.name.size() || data.compare(at + LOCAL_HEADER_SIZE, name_length, entry.name) != 0) {
+                error = "The central directory disagrees with the local header of " + entry.name;
+                return false;
+            }
+            if (flags & FLAG_ENCRYPTED) {
+                error = entry.name + " is encrypted";
+                return false;
+            }
+            if (method != METHOD_STORED && method != METHOD_DEFLATED) {
+                error = entry.name + " uses an unsupported compression method (" + std::to_string(method) + ")";
+                return false;
+            }
+            if (start + entry.compressed_size > end) {
+                error = entry.name + " is cut short";
+                return false;
+            }
+
+            FILE* file = fopen(pending.c_str(), "wb");
+            if (file == nullptr) {
+                error = "Couldn't create " + pending;
+                return false;
+            }
+            uint32_t crc = 0;
+            uint64_t written = 0;
+            bool ok = true;
+            if (method == METHOD_STORED) {
+                ok = writeOutput(file, data.data() + start, entry.compressed_size, crc, written);
+            }
+            else {
+                z_stream inflate_stream = {};
+                ok = inflateInit2(&inflate_stream, -MAX_WBITS) == Z_OK; // raw deflate, zip has no zlib header
+                std::unique_ptr<char[]> output(new char[OUTPUT_CHUNK_SIZE]);
+                const char* input = data.data() + start;
+                uint64_t input_left = entry.compressed_size;
+                int result = Z_OK;
+                while (ok && result != Z_STREAM_END) {
+                    if (inflate_stream.avail_in == 0 && input_left > 0) {
+                        uInt chunk = (uInt)std::min<uint64_t>(input_left, UINT32_MAX);
+                        inflate_stream.next_in = (Bytef*)input;
+                        inflate_stream.avail_in = chunk;
+                        input += chunk;
+                        input_left -= chunk;
+                    }
+                    inflate_stream.next_out = (Bytef*)output.get();
+                    inflate_stream.avail_out = OUTPUT_CHUNK_SIZE;
+                    result = inflate(&inflate_stream, Z_NO_FLUSH);
+                    // Z_BUF_ERROR means the data ran out before the deflate stream ended
+                    ok = (result == Z_OK || result == Z_STREAM_END) && writeOutput(file, output.get(), OUTPUT_CHUNK_SIZE - inflate_stream.avail_out, crc, written);
+                }
+                inflateEnd(&inflate_stream);
+            }
+            ok = fclose(file) == 0 && ok;
+            if (!ok || crc != entry.crc || written != entry.size) {
+                error = entry.name + " is corrupt (checksum or size mismatch)";
+                return false;
+            }
+            return true;
+        }
+
+        void removePending(const std::vector<Pending>& pending) {
+            for (const Pending& file : pending) {
+                std::error_code error;
+                std::filesystem::remove(file.pending, error);
+            }
+        }
+    }
+
+    std::vector<ByteRange> planRanges(const RemoteArchive& archive, const std::vector<size_t>& entries) {
+        std::vector<uint64_t> starts;
+        starts.reserve(archive.entries.size());
+        for (const EntryInfo& entry : archive.entries)
+            starts.push_back(entry.offset);
+        std::sort(starts.begin(), starts.end());
+        std::vector<size_t> order = entries;
+        std::sort(order.begin(), order.end(), [&archive](size_t a, size_t b) { return archive.entries[a].offset < archive.entries[b].offset; });
+
+        std::vector<ByteRange> ranges;
+        for (size_t index : order) {
+            const EntryInfo& entry = archive.entries[index];
+            auto next = std::upper_bound(starts.begin(), starts.end(), entry.offset);
+            uint64_t end = next != starts.end() ? *next : archive.central_offset; // the data descriptor, if any, comes along
+            if (!ranges.empty() && entry.offset <= ranges.back().last + 1 + RANGE_MERGE_GAP) {
+                ranges.back().last = std::max(ranges.back().last, end - 1);
+                ranges.back().entries.push_back(index);
+            }
+            else
+                ranges.push_back({ entry.offset, end - 1, { index } });
+        }
+        return ranges;
+    }
+
+    RangeResult fetchChangedEntries(const std::string& url, const std::vector<std::string>& headers, const RemoteArchive& archive, const std::string& root,
+                                    InstallIndex& index, size_t parallel, RangeStats* stats, std::string* error) {
+        std::string base = root;
+        if (!base.empty() && base.back() != '/')
+            base += '/';
+        RangeStats counts = { 0, 0, 0, 0, false };
+        std::vector<size_t> changed;
+        std::string message;
+        for (size_t i = 0; i < archive.entries.size() && message.empty(); i++) {
+            const EntryInfo& entry = archive.entries[i];
+            if (!safeEntryName(entry.name)) {
+                message = entry.name + " points outside the install folder";
+                break;
+            }
+            std::error_code ignored;
+            if (entry.name.back() == '/')
+                std::filesystem::create_directories(base + entry.name, ignored);
+            else if (index.Unchanged(base + entry.name, entry.crc, entry.size))
+                counts.unchanged++;
+            else
+                changed.push_back(i);
+        }
+        std::vector<ByteRange> ranges = planRanges(archive, changed);
+        if (message.empty() && rangeBytes(ranges) * 100 > archive.size * RANGE_FETCH_MAX_SHARE) {
+            if (stats != nullptr)
+                *stats = counts;
+            return RangeResult::NOT_WORTH_IT;
+        }
+
+        std::deque<std::vector<ByteRange>> queue; // one request each
+        for (ByteRange& range : ranges) {
+            if (queue.empty() || queue.back().size() == RANGES_PER_REQUEST || rangeBytes(queue.back()) + range.last - range.first + 1 > RANGE_REQUEST_BYTES)
+                queue.emplace_back();
+            queue.back().push_back(std::move(range));
+        }
+        RangeResult result = RangeResult::INSTALLED;
+        std::vector<Pending> pending;
+        while (!queue.empty() && message.empty()) {
+            std::vector<std::vector<ByteRange>> batch;
+            while (!queue.empty() && batch.size() < std::max<size_t>(parallel, 1)) {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            std::vector<net::Request> requests;
+            for (const std::vector<ByteRange>& group : batch) {
+                net::Request request = { url, headers };
+                request.follow_redirects = true;
+                request.range = rangeHeader(group);
+                requests.push_back(request);
+            }
+            net::performBatch(requests);
+            counts.requests += requests.size();
+
+            bool one_at_a_time = false;
+            for (size_t i = 0; i < requests.size() && message.empty(); i++) {
+                net::Request& request = requests[i];
+                std::vector<Part> parts;
+                if (request.result == CURLE_WRITE_ERROR && request.http_code == 200) { // cut off by net, it would have sent the whole archive
+                    result = RangeResult::UNSUPPORTED;
+                    message = "The server doesn't support range requests";
+                    break;
+                }
+                if (!splitResponse(request, archive.size, parts)) {
+                    message = "Couldn't fetch the changed entries (HTTP " + std::to_string(request.http_code) + ")";
+                    break;
+                }
+                counts.bytes += request.body.size();
+                counts.multipart = counts.multipart || parts.size() > 1;
+                for (ByteRange& range : batch[i]) {
+                    auto part = std::find_if(parts.begin(), parts.end(), [&range](const Part& part) { return part.first <= range.first && part.last >= range.last; });
+                    if (part == parts.end()) {
+                        if (batch[i].size() == 1) {
+                            message = "The server answered with the wrong bytes";
+                            break;
+                        }
+                        one_at_a_time = true; // it only honoured part of the request, probably just the first range
+                        queue.push_back({ std::move(range) });
+                        continue;
+                    }
+                    size_t part_end = part->at + (part->last - part->first + 1);
+                    for (size_t entry_index : range.entries) {
+                        const EntryInfo& entry = archive.entries[entry_index];
+                        std::string path = base + entry.name;
+                        std::error_code ignored;
+                        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ignored);
+                        pending.push_back({ path + PENDING_SUFFIX, path, entry.crc, entry.size });
+                        if (!extractEntry(entry, request.body, part->at + (entry.offset - part->first), part_end, pending.back().pending, message))
+                            break;
+                        counts.changed++;
+                    }
+                    if (!message.empty())
+                        break;
+                }
+            }
+            if (one_at_a_time) { // the requests still queued would be answered the same way
+                std::deque<std::vector<ByteRange>> single;
+                for (std::vector<ByteRange>& group : queue)
+                    for (ByteRange& range : group)
+                        single.push_back({ std::move(range) });
+                queue.swap(single);
+            }
+        }
+        if (stats != nullptr)
+            *stats = counts;
+        if (!message.empty()) {
+            removePending(pending);
+            if (error != nullptr)
+                *error = message;
+            return result == RangeResult::UNSUPPORTED ? result : RangeResult::FAILED;
+        }
+
+        bool moved = true;
+        for (const Pending& file : pending) { // every entry checked out, now the installed files can go
+            std::error_code failed;
+            std::filesystem::remove(file.path, failed); // FAT can't rename over an existing file
+            std::filesystem::rename(file.pending, file.path, failed);
+            if (failed) {
+                moved = false;
+                message = "Couldn't move " + file.path + " into place";
+                std::filesystem::remove(file.pending, failed);
+            }
+            index.Record(file.path, file.crc, file.size); // forgets the ones that didn't make it
+        }
+        if (!moved && error != nullptr)
+            *error = message;
+        return moved ? RangeResult::INSTALLED : RangeResult::FAILED;
+    }
+}
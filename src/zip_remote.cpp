@@ -0,0 +1,170 @@
+#include "zip_remote.hpp"
+#include "net.hpp"
+#include "zip_format.hpp"
+
+namespace zip {
+
+    namespace { // zip remote detail stuff
+        using namespace format;
+
+        net::Request rangeRequest(const std::string& url, const std::vector<std::string>& headers, const std::string& range) {
+            net::Request request = { url, headers };
+            request.follow_redirects = true;
+            request.range = range;
+            return request;
+        }
+
+        /// Takes the body of a performed range request, first and total come from its Content-Range
+        bool takeRange(net::Request& request, const std::string& range, std::string& data, uint64_t& first, uint64_t& total, std::string& error) {
+            uint64_t last;
+            if (request.result == CURLE_WRITE_ERROR && request.http_code == 200) { // cut off by net, it would have sent the whole archive
+                error = "The server doesn't support range requests";
+                return false;
+            }
+            if (request.result != CURLE_OK || request.http_code != 206 || !net::parseContentRange(request.content_range, first, last, total) || request.body.size() != last - first + 1) {
+                error = "Couldn't fetch bytes " + range + " of the archive (HTTP " + std::to_string(request.http_code) + ")";
+                return false;
+            }
+            data = std::move(request.body);
+            return true;
+        }
+
+        bool fetchRange(const std::string& url, const std::vector<std::string>& headers, const std::string& range, std::string& data, uint64_t& first, uint64_t& total, std::string& error) {
+            net::Request request = rangeRequest(url, headers, range);
+            net::perform(request);
+            return takeRange(request, range, data, first, total, error);
+        }
+
+        std::string tailRange() {
+            return "-" + std::to_string(REMOTE_TAIL_SIZE);
+        }
+
+        /// The end of central directory record is the last one whose comment runs exactly to the end of the archive
+        size_t findEnd(const std::string& tail) {
+            if (tail.size() < END_SIZE)
+                return std::string::npos;
+            for (size_t at = tail.size() - END_SIZE + 1; at-- > 0;)
+                if (read32(tail, at) == END_SIGNATURE && at + END_SIZE + read16(tail, at + 20) == tail.size())
+                    return at;
+            return std::string::npos;
+        }
+
+        /// What a remote read has so far, data holds the archive from offset to its end
+        struct Tail {
+            const std::string& url;
+            const std::vector<std::string>& headers;
+            std::string data;
+            uint64_t offset;
+            uint64_t total;
+        };
+
+        /// Extends the tail back to from, a single request for everything that's missing
+        bool extendTail(Tail& tail, uint64_t from, std::string& error) {
+            if (from >= tail.offset)
+                return true;
+            std::string front;
+            uint64_t first;
+            uint64_t total;
+            if (!fetchRange(tail.url, tail.headers, std::to_string(from) + "-" + std::to_string(tail.offset - 1), front, first, total, error))
+                return false;
+            if (first != from || total != tail.total || front.size() != tail.offset - from) {
+                error = "The archive changed while it was being read";
+                return false;
+            }
+            tail.data = front + tail.data;
+            tail.offset = from;
+            return true;
+        }
+
+        /// Reads the directory out of a tail that already holds the last REMOTE_TAIL_SIZE bytes, fetching whatever else it needs
+        bool readDirectory(Tail& tail, RemoteArchive& archive, std::string& error) {
+            size_t end = findEnd(tail.data);
+            if (end == std::string::npos) {
+                error = "Not a zip archive";
+                return false;
+            }
+            uint64_t end_offset = tail.offset + end;
+            uint64_t count = read16(tail.data, end + 10);
+            uint64_t central_size = read32(tail.data, end + 12);
+            uint64_t central_offset = read32(tail.data, end + 16);
+            if (end >= ZIP64_LOCATOR_SIZE && read32(tail.data, end - ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_SIGNATURE) {
+                uint64_t zip64_offset = read64(tail.data, end - ZIP64_LOCATOR_SIZE + 8);
+                if (zip64_offset + ZIP64_END_SIZE > end_offset || !extendTail(tail, zip64_offset, error)) {
+                    error = error.empty() ? "The zip64 end of central directory record is broken" : error;
+                    return false;
+                }
+                size_t at = zip64_offset - tail.offset;
+                if (read32(tail.data, at) != ZIP64_END_SIGNATURE) {
+                    error = "The zip64 end of central directory record is broken";
+                    return false;
+                }
+                count = read64(tail.data, at + 32);
+                central_size = read64(tail.data, at + 40);
+                central_offset = read64(tail.data, at + 48);
+            }
+            if (central_offset + central_size > end_offset || central_size > MAX_CENTRAL_DIRECTORY_SIZE || count > central_size / CENTRAL_HEADER_SIZE) {
+                error = "The central directory is broken";
+                return false;
+            }
+            if (!extendTail(tail, central_offset, error))
+                return false;
+
+            archive = { tail.total, central_offset, 0, 0, {} };
+            archive.entries.reserve(count);
+            size_t at = central_offset - tail.offset;
+            size_t limit = at + central_size;
+            for (uint64_t i = 0; i < count; i++) {
+                if (at + CENTRAL_HEADER_SIZE > limit || read32(tail.data, at) != CENTRAL_SIGNATURE) {
+                    error = "The central directory is broken";
+                    return false;
+                }
+                size_t name_length = read16(tail.data, at + 28);
+                size_t extra_length = read16(tail.data, at + 30);
+                size_t comment_length = read16(tail.data, at + 32);
+                size_t record_size = CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length;
+                if (at + record_size > limit) {
+                    error = "The central directory is broken";
+                    return false;
+                }
+                EntryInfo entry = { tail.data.substr(at + CENTRAL_HEADER_SIZE, name_length), read32(tail.data, at + 16), read32(tail.data, at + 20), read32(tail.data, at + 24), read32(tail.data, at + 42) };
+                uint64_t* values[] = { &entry.size, &entry.compressed_size, &entry.offset };
+                applyZip64(tail.data.substr(at + CENTRAL_HEADER_SIZE + name_length, extra_length), values, 3);
+                if (entry.offset + entry.compressed_size > central_offset) {
+                    error = "The central directory is broken";
+                    return false;
+                }
+                archive.compressed_bytes += entry.compressed_size;
+                archive.uncompressed_bytes += entry.size;
+                archive.entries.push_back(entry);
+                at += record_size;
+            }
+            return true;
+        }
+    }
+
+    bool readRemoteDirectory(const std::string& url, const std::vector<std::string>& headers, RemoteArchive& archive, std::string* error) {
+        Tail tail = { url, headers, "", 0, 0 };
+        std::string message;
+        if (fetchRange(url, headers, tailRange(), tail.data, tail.offset, tail.total, message) && readDirectory(tail, archive, message))
+            return true;
+        if (error != nullptr)
+            *error = message;
+        return false;
+    }
+
+    void readRemoteDirectories(const std::vector<std::string>& urls, const std::vector<std::string>& headers, std::vector<std::unique_ptr<RemoteArchive>>& archives) {
+        std::vector<net::Request> requests;
+        for (const std::string& url : urls)
+            requests.push_back(rangeRequest(url, headers, tailRange()));
+        net::performBatch(requests);
+        archives.clear();
+        archives.resize(urls.size());
+        for (size_t i = 0; i < urls.size(); i++) {
+            Tail tail = { urls[i], headers, "", 0, 0 };
+            std::string message;
+            archives[i].reset(new RemoteArchive);
+            if (!takeRange(requests[i], tailRange(), tail.data, tail.offset, tail.total, message) || !readDirectory(tail, *archives[i], message))
+                archives[i].reset();
+        }
+    }
+}
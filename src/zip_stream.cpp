@@ -0,0 +1,400 @@
+#include "zip_stream.hpp"
+#include "hash.hpp"
+#include "zip_format.hpp"
+
+#include <algorithm>
+#include <filesystem>
+
+namespace zip {
+
+    namespace { // zip stream detail stuff
+        using namespace format;
+
+        static constexpr size_t MAX_RECORD_SIZE     = 1024 * 1024; // nothing legitimate comes close, stops a broken length from eating memory
+    }
+
+    bool safeEntryName(const std::string& name) {
+        if (name.empty() || name[0] == '/' || name[0] == '\\' || name.find(':') != std::string::npos)
+            return false;
+        size_t start = 0;
+        while (start <= name.size()) {
+            size_t end = name.find_first_of("/\\", start);
+            if (end == std::string::npos)
+                end = name.size();
+            if (end - start == 2 && name.compare(start, 2, "..") == 0)
+                return false;
+            start = end + 1;
+        }
+        return true;
+    }
+
+    StreamExtractor::StreamExtractor(const std::string& root, InstallIndex* index)
+        : m_Root(root), m_Index(index), m_State(State::RECORD), m_Needed(SIGNATURE_SIZE), m_Offset(0), m_RecordStart(0),
+          m_Flags(0), m_Method(0), m_Zip64(false), m_SizeKnown(false), m_Skipping(false), m_Consumed(0), m_Crc(0), m_Written(0),
+          m_File(nullptr), m_InflateReady(false), m_Output(new char[OUTPUT_CHUNK_SIZE]), m_Skipped(0), m_CentralCount(0), m_Descriptor(false) {
+        if (!m_Root.empty() && m_Root.back() != '/')
+            m_Root += '/';
+    }
+
+    StreamExtractor::~StreamExtractor() {
+        Abort();
+        if (m_InflateReady)
+            inflateEnd(&m_Inflate);
+    }
+
+    bool StreamExtractor::Fail(const std::string& error) {
+        if (m_State != State::FAILED)
+            m_Error = error;
+        m_State = State::FAILED;
+        if (m_File != nullptr) {
+            fclose(m_File);
+            m_File = nullptr;
+        }
+        return false;
+    }
+
+    bool StreamExtractor::Feed(const char* data, size_t size) {
+        while (size > 0) {
+            if (m_State == State::FAILED)
+                return false;
+            if (m_State == State::END) { // trailing bytes after the end record, nothing reads them
+                m_Offset += size;
+                return true;
+            }
+            if (m_State == State::DATA) {
+                size_t used = FeedData(data, size);
+                data += used;
+                size -= used;
+                m_Offset += used;
+                continue;
+            }
+            if (m_Record.empty())
+                m_RecordStart = m_Offset;
+            size_t take = std::min(size, m_Needed - m_Record.size());
+            m_Record.append(data, take);
+            data += take;
+            size -= take;
+            m_Offset += take;
+            // ParseRecord either asks for more of the record or consumes it, so this can't spin
+            while (m_State == State::RECORD && m_Record.size() == m_Needed)
+                if (!ParseRecord())
+                    return false;
+        }
+        return m_State != State::FAILED;
+    }
+
+    bool StreamExtractor::ParseRecord() {
+        if (m_Descriptor)
+            return ParseDescriptor();
+        size_t total = 0;
+        switch (read32(m_Record, 0)) {
+            case LOCAL_SIGNATURE:
+                if (m_CentralCount > 0)
+                    return Fail("An entry follows the central directory");
+                if (m_Needed < LOCAL_HEADER_SIZE) {
+                    m_Needed = LOCAL_HEADER_SIZE;
+                    return true;
+                }
+                total = LOCAL_HEADER_SIZE + read16(m_Record, 26) + read16(m_Record, 28);
+                if (m_Needed < total) {
+                    m_Needed = total;
+                    return true;
+                }
+                return BeginEntry();
+            case CENTRAL_SIGNATURE:
+                if (m_Needed < CENTRAL_HEADER_SIZE) {
+                    m_Needed = CENTRAL_HEADER_SIZE;
+                    return true;
+                }
+                total = CENTRAL_HEADER_SIZE + read16(m_Record, 28) + read16(m_Record, 30) + read16(m_Record, 32);
+                if (m_Needed < total) {
+                    m_Needed = total;
+                    return true;
+                }
+                return CheckCentralEntry();
+            case ZIP64_END_SIGNATURE:
+                if (m_Needed < ZIP64_END_SIZE) {
+                    m_Needed = ZIP64_END_SIZE;
+                    return true;
+                }
+                total = 12 + read64(m_Record, 4); // the size field doesn't count itself or the signature
+                if (total < ZIP64_END_SIZE || total > MAX_RECORD_SIZE)
+                    return Fail("The zip64 end of central directory record is broken");
+                if (m_Needed < total) {
+                    m_Needed = total;
+                    return true;
+                }
+                break;
+            case ZIP64_LOCATOR_SIGNATURE:
+                if (m_Needed < ZIP64_LOCATOR_SIZE) {
+                    m_Needed = ZIP64_LOCATOR_SIZE;
+                    return true;
+                }
+                break;
+            case END_SIGNATURE: {
+                if (m_Needed < END_SIZE) {
+                    m_Needed = END_SIZE;
+                    return true;
+                }
+                total = END_SIZE + read16(m_Record, 20);
+                if (m_Needed < total) {
+                    m_Needed = total;
+                    return true;
+                }
+                uint16_t listed = read16(m_Record, 10);
+                if (m_CentralCount != m_Entries.size() || (listed != 0xFFFF && listed != m_CentralCount))
+                    return Fail("The central directory lists " + std::to_string(m_CentralCount) + " entries, " + std::to_string(m_Entries.size()) + " were extracted");
+                m_State = State::END;
+                break;
+            }
+            default:
+                return Fail(m_RecordStart == 0 ? "Not a zip archive" : "Unexpected data at offset " + std::to_string(m_RecordStart));
+        }
+        m_Record.clear();
+        m_Needed = SIGNATURE_SIZE;
+        return true;
+    }
+
+    bool StreamExtractor::BeginEntry() {
+        m_Flags = read16(m_Record, 6);
+        m_Method = read16(m_Record, 8);
+        size_t name_length = read16(m_Record, 26);
+        m_Entry.name = m_Record.substr(LOCAL_HEADER_SIZE, name_length);
+        m_Entry.crc = read32(m_Record, 14);
+        m_Entry.compressed_size = read32(m_Record, 18);
+        m_Entry.size = read32(m_Record, 22);
+        m_Entry.offset = m_RecordStart;
+        std::string extra = m_Record.substr(LOCAL_HEADER_SIZE + name_length);
+        std::string field;
+        m_Zip64 = findExtra(extra, ZIP64_EXTRA_ID, field);
+        uint64_t* sizes[] = { &m_Entry.size, &m_Entry.compressed_size };
+        applyZip64(extra, sizes, 2);
+        m_Record.clear();
+        m_Needed = SIGNATURE_SIZE;
+
+        if (m_Flags & FLAG_ENCRYPTED)
+            return Fail(m_Entry.name + " is encrypted");
+        if (m_Method != METHOD_STORED && m_Method != METHOD_DEFLATED)
+            return Fail(m_Entry.name + " uses an unsupported compression method (" + std::to_string(m_Method) + ")");
+        if (!safeEntryName(m_Entry.name))
+            return Fail(m_Entry.name + " points outside the install folder");
+        if (m_EntryIndex.count(m_Entry.name) > 0)
+            return Fail(m_Entry.name + " is in the archive twice");
+        // a deflate stream finds its own end, stored data has nothing but the header to go by
+        m_SizeKnown = m_Method == METHOD_STORED || !(m_Flags & FLAG_DESCRIPTOR);
+        m_Consumed = 0;
+        m_Crc = 0;
+        m_Written = 0;
+
+        std::error_code error;
+        std::string path = m_Root + m_Entry.name;
+        m_Skipping = m_Index != nullptr && !(m_Flags & FLAG_DESCRIPTOR) && m_Entry.name.back() != '/' && m_Index->Unchanged(path, m_Entry.crc, m_Entry.size);
+        if (m_Skipping) { // the central directory still has to agree with the header, that's all the checking it gets
+            m_Crc = m_Entry.crc;
+            m_Written = m_Entry.size;
+            m_Skipped++;
+        }
+        else if (m_Entry.name.back() == '/') {
+            std::filesystem::create_directories(path, error);
+        }
+        else {
+            std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+            std::string pending = path + PENDING_SUFFIX;
+            m_File = fopen(pending.c_str(), "wb");
+            if (m_File == nullptr)
+                return Fail("Couldn't create " + path);
+            m_Extracted.push_back({ pending, m_Entries.size() }); // the entry is added once its data checked out
+        }
+
+        if (m_Method == METHOD_DEFLATED) {
+            m_Inflate.next_in = Z_NULL;
+            m_Inflate.avail_in = 0;
+            if (!m_InflateReady) {
+                m_Inflate.zalloc = Z_NULL;
+                m_Inflate.zfree = Z_NULL;
+                m_Inflate.opaque = Z_NULL;
+                if (inflateInit2(&m_Inflate, -MAX_WBITS) != Z_OK) // raw deflate, zip has its own headers
+                    return Fail("Couldn't start inflating");
+                m_InflateReady = true;
+            }
+            else
+                inflateReset(&m_Inflate);
+        }
+
+        m_State = State::DATA;
+        if (m_SizeKnown && m_Entry.compressed_size == 0) {
+            if (m_Method != METHOD_STORED)
+                return Fail(m_Entry.name + " has no data");
+            return EndEntryData();
+        }
+        return true;
+    }
+
+    size_t StreamExtractor::FeedData(const char* data, size_t size) {
+        size_t limit = size;
+        if (m_SizeKnown && m_Entry.compressed_size - m_Consumed < limit)
+            limit = m_Entry.compressed_size - m_Consumed;
+
+        if (m_Skipping) {
+            m_Consumed += limit;
+            if (m_Consumed == m_Entry.compressed_size)
+                EndEntryData();
+            return limit;
+        }
+        if (m_Method == METHOD_STORED) {
+            if (!WriteOutput(data, limit))
+                return limit;
+            m_Consumed += limit;
+            if (m_Consumed == m_Entry.compressed_size)
+                EndEntryData();
+            return limit;
+        }
+
+        m_Inflate.next_in = (Bytef*)data;
+        m_Inflate.avail_in = limit;
+        int result;
+        while (true) {
+            m_Inflate.next_out = (Bytef*)m_Output.get();
+            m_Inflate.avail_out = OUTPUT_CHUNK_SIZE;
+            result = inflate(&m_Inflate, Z_NO_FLUSH);
+            if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+                Fail(m_Entry.name + " is corrupt (" + (m_Inflate.msg != nullptr ? m_Inflate.msg : "inflate failed") + ")");
+                return limit;
+            }
+            size_t produced = OUTPUT_CHUNK_SIZE - m_Inflate.avail_out;
+            if (produced > 0 && !WriteOutput(m_Output.get(), produced))
+                return limit;
+            // done when the stream ended or inflate has neither input left nor output held back
+            if (result != Z_OK || (m_Inflate.avail_in == 0 && m_Inflate.avail_out > 0))
+                break;
+        }
+        size_t used = limit - m_Inflate.avail_in;
+        m_Consumed += used;
+        if (result == Z_STREAM_END)
+            EndEntryData();
+        else if (m_SizeKnown && m_Consumed == m_Entry.compressed_size)
+            Fail(m_Entry.name + " is cut short");
+        return used;
+    }
+
+    bool StreamExtractor::WriteOutput(const char* data, size_t size) {
+        m_Crc = hash::crc32(m_Crc, data, size);
+        m_Written += size;
+        if (m_File != nullptr && fwrite(data, 1, size, m_File) != size)
+            return Fail("Couldn't write " + m_Root + m_Entry.name + ", is the card full?");
+        return true;
+    }
+
+    bool StreamExtractor::EndEntryData() {
+        m_State = State::RECORD;
+        if (m_Flags & FLAG_DESCRIPTOR) { // the real crc and sizes come next
+            m_Descriptor = true;
+            m_Record.clear();
+            m_Needed = SIGNATURE_SIZE;
+            return true;
+        }
+        return CloseEntry(m_Entry.crc, m_Entry.compressed_size, m_Entry.size);
+    }
+
+    bool StreamExtractor::ParseDescriptor() {
+        size_t body = m_Zip64 ? 20 : 12; // crc + two sizes, 8 bytes each for zip64 entries
+        if (m_Needed == SIGNATURE_SIZE) { // the signature is optional, without it these 4 bytes are the crc
+            m_Needed = read32(m_Record, 0) == DESCRIPTOR_SIGNATURE ? SIGNATURE_SIZE + body : body;
+            return true;
+        }
+        size_t at = m_Needed - body;
+        uint32_t crc = read32(m_Record, at);
+        uint64_t compressed_size = m_Zip64 ? read64(m_Record, at + 4) : read32(m_Record, at + 4);
+        uint64_t size = m_Zip64 ? read64(m_Record, at + 12) : read32(m_Record, at + 8);
+        m_Descriptor = false;
+        m_Record.clear();
+        m_Needed = SIGNATURE_SIZE;
+        return CloseEntry(crc, compressed_size, size);
+    }
+
+    bool StreamExtractor::CloseEntry(uint32_t crc, uint64_t compressed_size, uint64_t size) {
+        if (m_File != nullptr) {
+            bool closed = fclose(m_File) == 0;
+            m_File = nullptr;
+            if (!closed)
+                return Fail("Couldn't write " + m_Root + m_Entry.name + ", is the card full?");
+        }
+        if (crc != m_Crc || size != m_Written || compressed_size != m_Consumed)
+            return Fail(m_Entry.name + " is corrupt (checksum or size mismatch)");
+        m_Entry.crc = crc;
+        m_Entry.compressed_size = compressed_size;
+        m_Entry.size = size;
+        m_EntryIndex[m_Entry.name] = m_Entries.size();
+        m_Entries.push_back(m_Entry);
+        return true;
+    }
+
+    bool StreamExtractor::CheckCentralEntry() {
+        size_t name_length = read16(m_Record, 28);
+        size_t extra_length = read16(m_Record, 30);
+        std::string name = m_Record.substr(CENTRAL_HEADER_SIZE, name_length);
+        uint32_t crc = read32(m_Record, 16);
+        uint64_t compressed_size = read32(m_Record, 20);
+        uint64_t size = read32(m_Record, 24);
+        uint64_t offset = read32(m_Record, 42);
+        uint64_t* values[] = { &size, &compressed_size, &offset };
+        applyZip64(m_Record.substr(CENTRAL_HEADER_SIZE + name_length, extra_length), values, 3);
+        m_Record.clear();
+        m_Needed = SIGNATURE_SIZE;
+
+        auto found = m_EntryIndex.find(name);
+        if (found == m_EntryIndex.end())
+            return Fail(name + " is in the central directory but not in the archive");
+        const EntryInfo& entry = m_Entries[found->second];
+        if (entry.crc != crc || entry.compressed_size != compressed_size || entry.size != size || entry.offset != offset)
+            return Fail("The central directory disagrees with the local header of " + name);
+        m_CentralCount++;
+        return true;
+    }
+
+    bool StreamExtractor::Finish() {
+        if (m_State == State::FAILED)
+            return false;
+        if (m_State != State::END)
+            return Fail("The archive ended early");
+        return true;
+    }
+
+    bool StreamExtractor::Commit() {
+        if (m_State != State::END)
+            return false;
+        bool ok = true;
+        for (auto& pair : m_Extracted) {
+            if (pair.first.empty())
+                continue;
+            const EntryInfo& entry = m_Entries[pair.second];
+            std::string path = m_Root + entry.name;
+            std::error_code error;
+            std::filesystem::remove(path, error); // FAT can't rename over an existing file
+            std::filesystem::rename(pair.first, path, error);
+            if (error) {
+                m_Error = "Couldn't move " + path + " into place";
+                ok = false;
+                continue;
+            }
+            pair.first.clear();
+            if (m_Index != nullptr)
+                m_Index->Record(path, entry.crc, entry.size);
+        }
+        return ok;
+    }
+
+    void StreamExtractor::Abort() {
+        if (m_File != nullptr) {
+            fclose(m_File);
+            m_File = nullptr;
+        }
+        for (auto& pair : m_Extracted) {
+            if (pair.first.empty())
+                continue;
+            std::error_code error;
+            std::filesystem::remove(pair.first, error);
+            pair.first.clear();
+        }
+    }
+}